@@ -0,0 +1,247 @@
+/*
+ * Checks the estimates of cost_model: the square root it uses instead
+ * of libm, the plain average while warming up, the convergence of the
+ * moving averages on steady and noisy costs, the clamping of outliers
+ * and recording from several threads.
+ *
+ * From code/:
+ *   gcc -O2 -o /tmp/cost_model_check bench/cost_model_check.c cost_model.c -lpthread
+ *   /tmp/cost_model_check [seed, 1]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "../cost_model.h"
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
+
+#define CHECK_STEADY 1000
+#define CHECK_NOISY_SAMPLES (20 * 1000)
+#define CHECK_THREADS 8
+#define CHECK_THREAD_SAMPLES (100 * 1000)
+
+double __cost_model_sqrt(double x); // NOLINT(bugprone-reserved-identifier)
+
+uint64_t check_state;
+
+/**
+ * xorshift64, so that a seed gives the same run everywhere.
+ * @return the next pseudo random number
+ */
+uint64_t check_random(void) {
+    check_state ^= check_state << 13;
+    check_state ^= check_state >> 7;
+    check_state ^= check_state << 17;
+    return check_state;
+}
+
+/**
+ * Reports a failed check.
+ * @param ok whether the check passed
+ * @param what what was checked
+ * @param got the value found
+ * @return ok
+ */
+bool check(bool ok, const char *what, double got) {
+    if (!ok) fprintf(stderr, "%s: got %g\n", what, got);
+    return ok;
+}
+
+/**
+ * Checks the square root on exact squares, on values across the range
+ * of doubles and on 0 and negative values.
+ * @return whether every root is within a few ulps
+ */
+bool check_sqrt(void) {
+    static const double exact[][2] = {{0, 0}, {1, 1}, {4, 2}, {0.25, 0.5}, {1e6, 1e3}, {1e-6, 1e-3}};
+    bool ok = true;
+
+    for (size_t i = 0; i < sizeof(exact) / sizeof(exact[0]); ++i)
+        ok = check(__cost_model_sqrt(exact[i][0]) == exact[i][1], "sqrt of an exact square", exact[i][0]) && ok;
+
+    ok = check(__cost_model_sqrt(-4) == 0, "sqrt of a negative value", __cost_model_sqrt(-4)) && ok;
+
+    for (double x = 1e-300; x < 1e300; x *= 1.37) {
+        double root = __cost_model_sqrt(x);
+        double err = (root * root - x) / x;
+
+        ok = check(err < 1e-15 && err > -1e-15, "relative error of sqrt squared", err) && ok;
+    }
+
+    return ok;
+}
+
+/**
+ * Checks that the first samples make a plain average and that the
+ * prior is forgotten at the first sample.
+ * @return whether the mean is the average of the samples so far
+ */
+bool check_warmup(void) {
+    cost_model m;
+    long sum = 0;
+    bool ok = true;
+
+    cost_model_init(&m, 123456);
+    ok = check(cost_model_mean(&m) == 123456, "mean without samples", (double) cost_model_mean(&m)) && ok;
+
+    for (long n = 1; n <= COST_MODEL_WARMUP; ++n) {
+        long sample = 1000 + (long) (check_random() % 1000);
+
+        sum += sample;
+        cost_model_record(&m, sample);
+
+        long average = sum / n, mean = cost_model_mean(&m);
+        ok = check(mean >= average - 1 && mean <= average + 1, "mean while warming up", (double) mean) && ok;
+    }
+
+    return ok;
+}
+
+/**
+ * Checks a steady cost, then a lasting step of the cost: the mean must
+ * reach the new cost within a few dozen samples, clamping only slows it.
+ * @return whether the mean converges both times
+ */
+bool check_steady(void) {
+    cost_model m;
+    bool ok = true;
+
+    cost_model_init(&m, 0);
+    for (int i = 0; i < 100; ++i) cost_model_record(&m, CHECK_STEADY);
+
+    ok = check(cost_model_mean(&m) == CHECK_STEADY, "mean of a steady cost", (double) cost_model_mean(&m)) && ok;
+    ok = check(cost_model_stddev(&m) == 0, "deviation of a steady cost", (double) cost_model_stddev(&m)) && ok;
+
+    int samples = 0;
+    while (cost_model_mean(&m) < 2 * CHECK_STEADY * 99 / 100 && samples < 1000) {
+        cost_model_record(&m, 2 * CHECK_STEADY);
+        samples++;
+    }
+
+    printf("steady: a doubled cost is within 1 %% after %d samples\n", samples);
+
+    return check(samples <= 64, "samples to follow a doubled cost", samples) && ok;
+}
+
+/**
+ * Checks a cost spread uniformly from 50 % to 150 % of CHECK_STEADY,
+ * on the mean and deviation averaged over the second half of the run.
+ * @return whether both are close to those of the distribution
+ */
+bool check_noisy(void) {
+    cost_model m;
+    double mean = 0, dev = 0;
+    bool ok = true;
+
+    cost_model_init(&m, 0);
+
+    for (int i = 0; i < CHECK_NOISY_SAMPLES; ++i) {
+        cost_model_record(&m, CHECK_STEADY / 2 + (long) (check_random() % (CHECK_STEADY + 1)));
+
+        if (i >= CHECK_NOISY_SAMPLES / 2) {
+            mean += (double) cost_model_mean(&m);
+            dev += (double) cost_model_stddev(&m);
+        }
+    }
+
+    mean /= CHECK_NOISY_SAMPLES / 2;
+    dev /= CHECK_NOISY_SAMPLES / 2;
+
+    // uniform over a width of CHECK_STEADY, a deviation of CHECK_STEADY / sqrt(12)
+    double expected_dev = CHECK_STEADY / 3.4641;
+
+    printf("noisy: mean %.1f deviation %.1f, expected %d and %.1f\n", mean, dev, CHECK_STEADY, expected_dev);
+
+    ok = check(mean > CHECK_STEADY * 0.98 && mean < CHECK_STEADY * 1.02, "mean of a noisy cost", mean) && ok;
+    ok = check(dev > expected_dev * 0.8 && dev < expected_dev * 1.2, "deviation of a noisy cost", dev) && ok;
+
+    return ok;
+}
+
+/**
+ * Checks that one outlier moves a warm model by at most
+ * COST_MODEL_ALPHA of COST_MODEL_CLAMP deviations, the deviation being
+ * at least 1 / COST_MODEL_MIN_DEV of the mean.
+ * @return whether outliers both ways are clamped
+ */
+bool check_clamp(void) {
+    double bound = COST_MODEL_ALPHA * COST_MODEL_CLAMP * CHECK_STEADY / COST_MODEL_MIN_DEV;
+    cost_model m;
+    bool ok = true;
+
+    cost_model_init(&m, 0);
+    for (int i = 0; i < 100; ++i) cost_model_record(&m, CHECK_STEADY);
+
+    cost_model_record(&m, 1000L * 1000 * 1000 * 1000);
+    long mean = cost_model_mean(&m);
+    ok = check(mean >= CHECK_STEADY && mean <= CHECK_STEADY + bound, "mean after a high outlier", (double) mean) && ok;
+
+    cost_model_init(&m, 0);
+    for (int i = 0; i < 100; ++i) cost_model_record(&m, CHECK_STEADY);
+
+    cost_model_record(&m, 0);
+    mean = cost_model_mean(&m);
+    ok = check(mean <= CHECK_STEADY && mean >= CHECK_STEADY - bound - 1, "mean after a low outlier", (double) mean) && ok;
+
+    return ok;
+}
+
+/**
+ * Records costs from 50 % to 150 % of CHECK_STEADY into a shared model.
+ * @param v_m the model
+ * @return NULL
+ */
+void *check_record(void *v_m) {
+    for (long i = 0; i < CHECK_THREAD_SAMPLES; ++i)
+        cost_model_record((cost_model *) v_m, CHECK_STEADY / 2 + i * 7919 % (CHECK_STEADY + 1));
+
+    return NULL;
+}
+
+/**
+ * Checks a model recorded into by CHECK_THREADS threads at once: no
+ * sample is lost, the mean stays within the range of the samples.
+ * @return whether the model is consistent
+ */
+bool check_threads(void) {
+    pthread_t ids[CHECK_THREADS];
+    cost_model m;
+    bool ok = true;
+
+    cost_model_init(&m, 0);
+
+    for (int i = 0; i < CHECK_THREADS; ++i) pthread_create(ids + i, NULL, check_record, &m);
+    for (int i = 0; i < CHECK_THREADS; ++i) pthread_join(ids[i], NULL);
+
+    long samples = atomic_load(&m.samples), mean = cost_model_mean(&m);
+
+    ok = check(samples == CHECK_THREADS * CHECK_THREAD_SAMPLES, "samples from all threads", (double) samples) && ok;
+    ok = check(mean >= CHECK_STEADY / 2 && mean <= CHECK_STEADY * 3 / 2, "mean from all threads", (double) mean) && ok;
+
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    static const struct {
+        const char *name;
+        bool (*run)(void);
+    } checks[] = {{"sqrt", check_sqrt}, {"warmup", check_warmup}, {"steady", check_steady},
+                  {"noisy", check_noisy}, {"clamp", check_clamp}, {"threads", check_threads}};
+
+    bool ok = true;
+
+    check_state = argc > 1 ? strtoull(argv[1], NULL, 10) : 1;
+    if (0 == check_state) check_state = 1;
+
+    for (size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); ++i) {
+        bool check_ok = checks[i].run();
+
+        printf("%s: %s\n", checks[i].name, check_ok ? "ok" : "FAILED");
+        ok = ok && check_ok;
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
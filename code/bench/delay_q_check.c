@@ -0,0 +1,289 @@
+/*
+ * Checks the release times of the timer wheel of delay_q.
+ *
+ * First on a wheel advanced by hand: tasks due anywhere from the past
+ * to 4 times beyond the range of the wheel are put while the wheel
+ * moves by steps of 1 tick to 2^20 ticks. Every task must come out of
+ * the step covering its due tick, never before, never after, and tasks
+ * put on the same tick with the same due tick in the order they were
+ * put.
+ *
+ * Then on the clock, with delay_q_run: every task must reach the
+ * target queue, none before its release time. The lateness is only
+ * reported.
+ *
+ * Last with a bounded target nobody takes from, closed while the
+ * wheel waits for room: every task must either be in the target or
+ * go to the drop function, once.
+ *
+ * From code/:
+ *   gcc -O2 -o /tmp/delay_q_check bench/delay_q_check.c delay_q.c blocking_q.c monotonic.c -lpthread
+ *   /tmp/delay_q_check [seed, 1]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "../blocking_q.h"
+#include "../delay_q.h"
+#include "../monotonic.h"
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
+
+#define CHECK_TASKS (200 * 1000)
+#define CHECK_RANGE (1L << (DELAY_Q_SLOT_BITS * DELAY_Q_LEVELS))
+#define CHECK_MAX_STEP (1L << 20)
+
+#define CHECK_CLOCK_TASKS 2000
+#define CHECK_CLOCK_TICK 1000000L
+#define CHECK_CLOCK_SPAN 200000000L
+
+#define CHECK_CLOSED_TASKS 1000
+#define CHECK_CLOSED_CAPACITY 16
+
+delay_q_node *__delay_q_advance(delay_q *dq, long now); // NOLINT(bugprone-reserved-identifier)
+
+task tasks[CHECK_TASKS];
+uint64_t check_state;
+
+/**
+ * xorshift64, so that a seed gives the same run everywhere.
+ * @return the next pseudo random number
+ */
+uint64_t check_random(void) {
+    check_state ^= check_state << 13;
+    check_state ^= check_state >> 7;
+    check_state ^= check_state << 17;
+    return check_state;
+}
+
+/**
+ * A distance to the due tick: in the past, within each level, or
+ * beyond the range of the wheel.
+ * @return the distance in ticks
+ */
+long check_delta(void) {
+    switch (check_random() % 6) {
+        case 0:
+            return -(long) (check_random() % 1000);
+        case 1:
+            return (long) (check_random() % DELAY_Q_SLOTS);
+        case 2:
+            return (long) (check_random() % (DELAY_Q_SLOTS * DELAY_Q_SLOTS));
+        case 3:
+            return (long) (check_random() % (CHECK_RANGE / DELAY_Q_SLOTS));
+        case 4:
+            return (long) (check_random() % CHECK_RANGE);
+        default:
+            return CHECK_RANGE - 2 + (long) (check_random() % (3 * CHECK_RANGE));
+    }
+}
+
+/**
+ * Advances the wheel by hand and checks what comes out of each step.
+ * A task keeps its due tick in `deadline`, the tick it was put on in
+ * `enqueued` and its rank among the puts in `start`.
+ * @return whether every task came out on time, and once
+ */
+bool check_wheel(void) {
+    blocking_q target;
+    delay_q dq;
+    long put = 0, released = 0, last = 0;
+    bool ok = true;
+
+    if (!blocking_q_init(&target)) return false;
+    if (!delay_q_init(&dq, &target, 1)) return false;
+
+    // past the last due tick, a task still held is lost
+    while (put < CHECK_TASKS || (dq.sz > 0 && dq.current <= last)) {
+        // a few puts, sometimes several with the same due tick
+        for (long n = (long) (check_random() % 8); n > 0 && put < CHECK_TASKS; --n) {
+            long due = dq.current + check_delta();
+            long same = 1 + (long) (check_random() % 3);
+
+            for (; same > 0 && put < CHECK_TASKS; --same, ++put) {
+                task_ptr t = tasks + put;
+
+                t->deadline = due < 0 ? 0 : due;
+                t->enqueued = dq.current;
+                t->start = put;
+                if (t->deadline > last) last = t->deadline;
+
+                if (!delay_q_put(&dq, t, dq.epoch + due)) return false;
+            }
+        }
+
+        long from = dq.current;
+        long step = check_random() % 4 ? 1 + (long) (check_random() % 64) : 1 + (long) (check_random() % CHECK_MAX_STEP);
+        long now = from + step - 1;
+
+        delay_q_node *curr = __delay_q_advance(&dq, now);
+        task_ptr prev = NULL;
+
+        while (curr != NULL) {
+            task_ptr t = curr->data;
+            long expected = t->deadline > t->enqueued ? t->deadline : t->enqueued;
+
+            if (expected < from || expected > now) {
+                fprintf(stderr, "task due on %ld put on %ld released by the step from %ld to %ld\n",
+                        t->deadline, t->enqueued, from, now);
+                ok = false;
+            }
+
+            // FIFO among the tasks due on the same tick and put on the same tick
+            if (prev != NULL && prev->deadline == t->deadline && prev->enqueued == t->enqueued
+                && prev->start > t->start) {
+                fprintf(stderr, "task %ld released before task %ld, both due on %ld\n",
+                        prev->start, t->start, t->deadline);
+                ok = false;
+            }
+
+            released++;
+            prev = t;
+
+            delay_q_node *next = curr->next;
+            free(curr);
+            curr = next;
+        }
+    }
+
+    if (released != CHECK_TASKS) {
+        fprintf(stderr, "%ld tasks released out of %d\n", released, CHECK_TASKS);
+        ok = false;
+    }
+
+    delay_q_destroy(&dq);
+    blocking_q_destroy(&target);
+
+    return ok;
+}
+
+/**
+ * Runs the wheel on the clock and checks that no task is released
+ * early. A task keeps its release time in `deadline`.
+ * @return whether no task came out early, and every task came out
+ */
+bool check_clock(void) {
+    blocking_q target;
+    delay_q dq;
+    pthread_t runner;
+    long got = 0, late_max = 0;
+    bool ok = true;
+
+    if (!blocking_q_init(&target)) return false;
+    if (!delay_q_init(&dq, &target, CHECK_CLOCK_TICK)) return false;
+
+    pthread_create(&runner, NULL, delay_q_run, &dq);
+
+    for (long i = 0; i < CHECK_CLOCK_TASKS; ++i) {
+        task_ptr t = tasks + i;
+
+        t->deadline = monotonic_now() + (long) (check_random() % CHECK_CLOCK_SPAN);
+        if (!delay_q_put(&dq, t, t->deadline)) return false;
+    }
+
+    delay_q_close(&dq);
+
+    // every task is due within CHECK_CLOCK_SPAN, waiting longer means some were lost
+    for (task_ptr t; (t = blocking_q_get_timeout(&target, CHECK_CLOCK_SPAN)) != NULL; ++got) {
+        long late = monotonic_now() - t->deadline;
+
+        if (late < 0) {
+            fprintf(stderr, "task released %ld ns early\n", -late);
+            ok = false;
+        }
+        if (late > late_max) late_max = late;
+    }
+
+    // the runner still waits on the lost tasks, it is left behind
+    if (got != CHECK_CLOCK_TASKS) {
+        fprintf(stderr, "%ld tasks released out of %d\n", got, CHECK_CLOCK_TASKS);
+        return false;
+    }
+
+    pthread_join(runner, NULL);
+
+    printf("clock: at most %.2f ms late, with a tick of %.2f ms\n", late_max / 1e6, CHECK_CLOCK_TICK / 1e6);
+
+    delay_q_destroy(&dq);
+    blocking_q_destroy(&target);
+
+    return ok;
+}
+
+/**
+ * Counts a task the target refused. Tasks count their drops in `end`.
+ * @param t the task
+ * @param arg unused
+ */
+void check_drop(task_ptr t, void *arg) {
+    (void) arg;
+    t->end++;
+}
+
+/**
+ * Closes a full target under the wheel and checks that the tasks it
+ * refused go to the drop function.
+ * @return whether every task was either delivered or dropped, once
+ */
+bool check_closed(void) {
+    blocking_q target;
+    delay_q dq;
+    pthread_t runner;
+    bool ok = true;
+
+    if (!blocking_q_init_with(&target, BLOCKING_Q_RING, CHECK_CLOSED_CAPACITY)) return false;
+    if (!delay_q_init(&dq, &target, CHECK_CLOCK_TICK)) return false;
+
+    delay_q_set_on_drop(&dq, check_drop, NULL);
+
+    for (long i = 0; i < CHECK_CLOSED_TASKS; ++i) {
+        tasks[i].end = 0;
+        if (!delay_q_put(&dq, tasks + i, monotonic_now())) return false;
+    }
+
+    pthread_create(&runner, NULL, delay_q_run, &dq);
+
+    // the wheel fills the target, then waits for room
+    while (blocking_q_size(&target) < CHECK_CLOSED_CAPACITY);
+
+    blocking_q_close(&target);
+    delay_q_close(&dq);
+    pthread_join(runner, NULL);
+
+    for (task_ptr t; (t = blocking_q_try_get(&target)) != NULL;) t->end++;
+
+    for (long i = 0; i < CHECK_CLOSED_TASKS; ++i) {
+        if (tasks[i].end != 1) {
+            fprintf(stderr, "task %ld delivered or dropped %ld times\n", i, tasks[i].end);
+            ok = false;
+        }
+    }
+
+    if (dq.dropped != CHECK_CLOSED_TASKS - CHECK_CLOSED_CAPACITY) {
+        fprintf(stderr, "%zu tasks dropped, expected %d\n", dq.dropped, CHECK_CLOSED_TASKS - CHECK_CLOSED_CAPACITY);
+        ok = false;
+    }
+
+    delay_q_destroy(&dq);
+    blocking_q_destroy(&target);
+
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    check_state = argc > 1 ? strtoull(argv[1], NULL, 10) : 1;
+    if (0 == check_state) check_state = 1;
+
+    bool wheel_ok = check_wheel();
+    printf("wheel: %s\n", wheel_ok ? "ok" : "FAILED");
+
+    bool clock_ok = check_clock();
+    printf("clock: %s\n", clock_ok ? "ok" : "FAILED");
+
+    bool closed_ok = check_closed();
+    printf("closed: %s\n", closed_ok ? "ok" : "FAILED");
+
+    return wheel_ok && clock_ok && closed_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,71 @@
+/*
+ * Cost of picking a processor, for each policy and pool size. Every
+ * processor is marked running with an uneven load, no thread runs, so
+ * this only times the picks the scheduler makes per task.
+ *
+ * From code/:
+ *   gcc -O2 -o /tmp/dispatch_cost bench/dispatch_cost.c processor.c sched_policy.c task.c blocking_q.c \
+ *       cost_model.c histogram.c monotonic.c ws_deque.c -lpthread
+ *   /tmp/dispatch_cost
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include "../monotonic.h"
+#include "../processor.h"
+#include "../sched_policy.h"
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
+
+#define BENCH_PICKS (2 * 1000 * 1000)
+
+// Picks end up here so that they are not optimized out
+volatile long bench_sink;
+
+int main(void) {
+    static const char *policies[] = {"round-robin", "random", "least-queued", "least-outstanding",
+                                     "least-expected-work", "power-of-d-queued", "power-of-d-work"};
+    static const int sizes[] = {4, 16, 64, 256};
+    static const size_t sizes_n = sizeof(sizes) / sizeof(sizes[0]);
+
+    printf("%-22s", "policy \\ processors");
+    for (size_t s = 0; s < sizes_n; ++s) printf("%8d", sizes[s]);
+    printf("   (ns/pick)\n");
+
+    for (size_t n = 0; n < sizeof(policies) / sizeof(policies[0]); ++n) {
+        printf("%-22s", policies[n]);
+
+        for (size_t s = 0; s < sizes_n; ++s) {
+            processor_pool pool;
+            sched_policy policy;
+
+            if (!processor_pool_init(&pool, 1, sizes[s], false)) return EXIT_FAILURE;
+
+            for (int i = 0; i < sizes[s]; ++i) {
+                atomic_store(&pool.processors[i].state, PROCESSOR_RUNNING);
+                atomic_store(&pool.processors[i].outstanding, i * 5 % 11);
+                atomic_store(&pool.processors[i].outstanding_cost, i * 7 % 13);
+            }
+
+            if (!sched_policy_init(&policy, sched_policy_find(policies[n]), &pool)) return EXIT_FAILURE;
+
+            task t = {.type = 'A'};
+            long ids = 0;
+
+            long t0 = monotonic_now();
+            for (long k = 0; k < BENCH_PICKS; ++k) ids += sched_policy_pick_processor(&policy, &t)->id;
+            long t1 = monotonic_now();
+
+            bench_sink = ids;
+            printf("%8.1f", (double) (t1 - t0) / BENCH_PICKS);
+
+            sched_policy_destroy(&policy);
+            processor_pool_destroy(&pool);
+        }
+
+        printf("\n");
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,75 @@
+/*
+ * Time and futex syscalls to move BENCH_TASKS tasks from one producer
+ * to one consumer through a bounded queue, for each bounded kind.
+ * syscall is counted by wrapping it at link time, so this only counts
+ * the futex path of Linux builds.
+ *
+ * From code/:
+ *   gcc -D_GNU_SOURCE -O2 -o /tmp/futex_wakeups bench/futex_wakeups.c blocking_q.c monotonic.c -lpthread -Wl,--wrap=syscall
+ *   /tmp/futex_wakeups
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "../blocking_q.h"
+#include "../monotonic.h"
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
+
+#define BENCH_TASKS (1000 * 1000)
+#define BENCH_CAPACITY 1024
+
+_Atomic long syscalls;
+task tk;
+
+long __real_syscall(long n, long a, long b, long c, long d, long e, long f); // NOLINT(bugprone-reserved-identifier)
+
+/**
+ * Counts the call, then makes it. blocking_q only passes the futex
+ * arguments, six at most.
+ * @param n the syscall number
+ * @return what the syscall returned
+ */
+long __wrap_syscall(long n, long a, long b, long c, long d, long e, long f) { // NOLINT(bugprone-reserved-identifier)
+    atomic_fetch_add_explicit(&syscalls, 1, memory_order_relaxed);
+    return __real_syscall(n, a, b, c, d, e, f);
+}
+
+/**
+ * Puts BENCH_TASKS tasks.
+ * @param v_q the queue
+ * @return NULL
+ */
+void *bench_produce(void *v_q) {
+    for (long i = 0; i < BENCH_TASKS; ++i) blocking_q_put((blocking_q *) v_q, &tk);
+    return NULL;
+}
+
+int main(void) {
+    static const struct {
+        const char *name;
+        blocking_q_kind kind;
+    } kinds[] = {{"ring", BLOCKING_Q_RING}, {"mpmc", BLOCKING_Q_MPMC}, {"spsc", BLOCKING_Q_SPSC}};
+
+    for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); ++k) {
+        blocking_q q;
+        pthread_t producer;
+
+        if (!blocking_q_init_with(&q, kinds[k].kind, BENCH_CAPACITY)) return EXIT_FAILURE;
+
+        atomic_store(&syscalls, 0);
+        long t0 = monotonic_now();
+        pthread_create(&producer, NULL, bench_produce, &q);
+        for (long i = 0; i < BENCH_TASKS; ++i) blocking_q_get(&q);
+        pthread_join(producer, NULL);
+        long t1 = monotonic_now();
+
+        printf("%s: %8.1f ms %8ld futex syscalls\n", kinds[k].name, (t1 - t0) / 1e6, atomic_load(&syscalls));
+
+        blocking_q_destroy(&q);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,215 @@
+/*
+ * Checks the buckets and percentiles of histogram.
+ *
+ * Buckets: every value below 2^16, then values around every power of
+ * two up to LONG_MAX, must fall in a bucket in range whose bounds
+ * enclose it, the buckets following each other without gap. Values
+ * below 2 * HISTOGRAM_SUB must be exact, larger ones off by less than
+ * 1 / HISTOGRAM_SUB.
+ *
+ * Percentiles: values spread over 12 powers of ten are recorded in
+ * CHECK_PARTS histograms, then merged. Every percentile
+ * must be the bucket bound of the exact nearest rank value, sorted
+ * out of all values, capped at the maximum.
+ *
+ * From code/:
+ *   gcc -O2 -o /tmp/histogram_check bench/histogram_check.c histogram.c
+ *   /tmp/histogram_check [seed, 1]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+#include "../histogram.h"
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
+
+#define CHECK_VALUES (1000 * 1000)
+#define CHECK_PARTS 4
+
+int __histogram_bucket(long value); // NOLINT(bugprone-reserved-identifier)
+
+long __histogram_value(int bucket); // NOLINT(bugprone-reserved-identifier)
+
+long values[CHECK_VALUES];
+histogram parts[CHECK_PARTS];
+uint64_t check_state;
+
+/**
+ * xorshift64, so that a seed gives the same run everywhere.
+ * @return the next pseudo random number
+ */
+uint64_t check_random(void) {
+    check_state ^= check_state << 13;
+    check_state ^= check_state >> 7;
+    check_state ^= check_state << 17;
+    return check_state;
+}
+
+/**
+ * Checks the bucket of a value.
+ * @param value the value, not negative
+ * @return whether the bucket is in range, encloses the value and is
+ * as precise as promised
+ */
+bool check_bucket(long value) {
+    int bucket = __histogram_bucket(value);
+
+    if (bucket < 0 || bucket >= HISTOGRAM_BUCKETS) {
+        fprintf(stderr, "%ld falls in bucket %d, out of range\n", value, bucket);
+        return false;
+    }
+
+    long low = 0 == bucket ? 0 : __histogram_value(bucket - 1) + 1;
+    long high = __histogram_value(bucket);
+
+    if (value < low || value > high) {
+        fprintf(stderr, "%ld falls in bucket %d, from %ld to %ld\n", value, bucket, low, high);
+        return false;
+    }
+
+    // the top of the bucket stands for the value, less than value / HISTOGRAM_SUB above
+    if (value < 2 * HISTOGRAM_SUB ? high != value : (high - value) >= value / HISTOGRAM_SUB) {
+        fprintf(stderr, "%ld recorded as %ld\n", value, high);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Checks the buckets of every value below 2^16 and of the values
+ * around the powers of two above, up to LONG_MAX.
+ * @return whether every bucket is right
+ */
+bool check_buckets(void) {
+    bool ok = true;
+
+    for (long value = 0; value < 1L << 16; ++value) ok = check_bucket(value) && ok;
+
+    for (int bit = 16; bit < 63; ++bit) {
+        long power = 1L << bit;
+
+        ok = check_bucket(power - 1) && ok;
+        ok = check_bucket(power) && ok;
+        ok = check_bucket(power + 1) && ok;
+        ok = check_bucket(power + (long) (check_random() % (uint64_t) power)) && ok;
+    }
+
+    ok = check_bucket(LONG_MAX) && ok;
+
+    // no gap nor overlap between two buckets
+    for (int bucket = 1; bucket < HISTOGRAM_BUCKETS; ++bucket) {
+        if (__histogram_bucket(__histogram_value(bucket - 1) + 1) != bucket) {
+            fprintf(stderr, "bucket %d does not follow bucket %d\n", bucket, bucket - 1);
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+/**
+ * Order of two values, for qsort.
+ * @param a the first value
+ * @param b the second value
+ * @return negative, zero or positive as a is lower, equal or higher
+ */
+int check_compare(const void *a, const void *b) {
+    long x = *(const long *) a, y = *(const long *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Checks a percentile of the merged histogram against the sorted
+ * values.
+ * @param h the histogram
+ * @param percentile the percentage
+ * @return whether the percentile is the bucket bound of the nearest
+ * rank value
+ */
+bool check_percentile(const histogram *h, double percentile) {
+    uint64_t rank = (uint64_t) (percentile / 100.0 * CHECK_VALUES + 0.5);
+    if (rank < 1) rank = 1;
+
+    long exact = values[rank - 1];
+    long expected = __histogram_value(__histogram_bucket(exact));
+    if (expected > h->max) expected = h->max;
+
+    long got = histogram_percentile(h, percentile);
+
+    if (got != expected || got < exact) {
+        fprintf(stderr, "p%g is %ld, the value of that rank is %ld, expected %ld\n", percentile, got, exact, expected);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Records values spread over 12 powers of ten in several histograms,
+ * merges them and checks the percentiles.
+ * @return whether every percentile is right
+ */
+bool check_percentiles(void) {
+    static const double percentiles[] = {0, 0.0001, 0.1, 1, 10, 25, 50, 75, 90, 99, 99.9, 99.99, 100};
+    histogram merged;
+    bool ok = true;
+
+    histogram_init(&merged);
+    if (0 != histogram_percentile(&merged, 50)) {
+        fprintf(stderr, "the median of an empty histogram is not 0\n");
+        ok = false;
+    }
+
+    for (int i = 0; i < CHECK_PARTS; ++i) histogram_init(parts + i);
+
+    for (long i = 0; i < CHECK_VALUES; ++i) {
+        long value = (long) (check_random() % 1000);
+        for (long scale = (long) (check_random() % 10); scale > 0; --scale) value *= 10;
+
+        // a negative value counts as 0
+        if (0 == i) value = -5;
+
+        histogram_record(parts + i % CHECK_PARTS, value);
+        values[i] = value < 0 ? 0 : value;
+    }
+
+    for (int i = 0; i < CHECK_PARTS; ++i) histogram_merge(&merged, parts + i);
+
+    qsort(values, CHECK_VALUES, sizeof(long), check_compare);
+
+    if (merged.count != CHECK_VALUES || merged.max != values[CHECK_VALUES - 1]) {
+        fprintf(stderr, "merged %lu values up to %ld, expected %d up to %ld\n", (unsigned long) merged.count,
+                merged.max, CHECK_VALUES, values[CHECK_VALUES - 1]);
+        ok = false;
+    }
+
+    for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); ++i)
+        ok = check_percentile(&merged, percentiles[i]) && ok;
+
+    for (int i = 0; i < 1000; ++i)
+        ok = check_percentile(&merged, (double) (check_random() % 1000001) / 10000) && ok;
+
+    if (histogram_percentile(&merged, 100) != merged.max) {
+        fprintf(stderr, "p100 is not the maximum\n");
+        ok = false;
+    }
+
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    check_state = argc > 1 ? strtoull(argv[1], NULL, 10) : 1;
+    if (0 == check_state) check_state = 1;
+
+    bool buckets_ok = check_buckets();
+    printf("buckets: %s\n", buckets_ok ? "ok" : "FAILED");
+
+    bool percentiles_ok = check_percentiles();
+    printf("percentiles: %s\n", percentiles_ok ? "ok" : "FAILED");
+
+    return buckets_ok && percentiles_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
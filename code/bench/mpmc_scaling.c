@@ -0,0 +1,145 @@
+/*
+ * Throughput of the bounded queue kinds against the thread count.
+ * With n threads, n / 2 produce and the others consume, a single
+ * thread puts and gets in turns. Every run moves BENCH_TASKS tasks
+ * through a queue of BENCH_CAPACITY, ops/s counts puts and gets.
+ *
+ * From code/:
+ *   gcc -O2 -o /tmp/mpmc_scaling bench/mpmc_scaling.c blocking_q.c monotonic.c -lpthread
+ *   /tmp/mpmc_scaling [max threads, 64] [tasks, 2000000]
+ *
+ * The numbers only mean something with at least as many CPUs as
+ * threads, oversubscribed runs mostly measure the parking.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "../blocking_q.h"
+#include "../monotonic.h"
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
+
+#define BENCH_TASKS (2 * 1000 * 1000)
+#define BENCH_CAPACITY 1024
+#define BENCH_MAX_THREADS 64
+
+typedef struct bench_run_data {
+    blocking_q *q;
+    pthread_barrier_t start;
+    long t0;
+} bench_run_data;
+
+typedef struct bench_worker {
+    bench_run_data *run;
+    long count;
+    bool produce;
+} bench_worker;
+
+/**
+ * Puts or gets `count` tasks once every worker is ready.
+ * @param v_worker the worker
+ * @return NULL
+ */
+void *bench_run(void *v_worker) {
+    bench_worker *w = (bench_worker *) v_worker;
+    blocking_q *q = w->run->q;
+    static task tk;
+
+    // The clock starts as the barrier lets everyone go
+    if (PTHREAD_BARRIER_SERIAL_THREAD == pthread_barrier_wait(&w->run->start)) w->run->t0 = monotonic_now();
+
+    if (w->produce) {
+        for (long i = 0; i < w->count; ++i) blocking_q_put(q, &tk);
+    } else {
+        for (long i = 0; i < w->count; ++i) blocking_q_get(q);
+    }
+
+    return NULL;
+}
+
+/**
+ * Moves `tasks` tasks through a queue of `kind` with `threads` threads.
+ * @param kind the queue kind
+ * @param threads the thread count
+ * @param tasks the tasks to move
+ * @return the puts and gets per second, a negative value on error
+ */
+double bench_kind(blocking_q_kind kind, int threads, long tasks) {
+    blocking_q q;
+    bench_run_data run;
+    pthread_t ids[BENCH_MAX_THREADS];
+    bench_worker workers[BENCH_MAX_THREADS];
+
+    if (!blocking_q_init_with(&q, kind, BENCH_CAPACITY)) return -1;
+    run.q = &q;
+
+    long t0, t1;
+
+    if (1 == threads) {
+        static task tk;
+
+        t0 = monotonic_now();
+        for (long i = 0; i < tasks; i += BENCH_CAPACITY / 2) {
+            long n = tasks - i < BENCH_CAPACITY / 2 ? tasks - i : BENCH_CAPACITY / 2;
+
+            for (long k = 0; k < n; ++k) blocking_q_put(&q, &tk);
+            for (long k = 0; k < n; ++k) blocking_q_get(&q);
+        }
+        t1 = monotonic_now();
+    } else {
+        int producers = threads / 2, consumers = threads - producers;
+
+        pthread_barrier_init(&run.start, NULL, (unsigned) threads);
+
+        for (int i = 0; i < threads; ++i) {
+            bool produce = i < producers;
+            int n = produce ? producers : consumers, rank = produce ? i : i - producers;
+
+            // Spread the remainder so that puts and gets match
+            workers[i] = (bench_worker) {&run, tasks / n + (rank < tasks % n), produce};
+            pthread_create(ids + i, NULL, bench_run, workers + i);
+        }
+
+        for (int i = 0; i < threads; ++i) pthread_join(ids[i], NULL);
+        t0 = run.t0;
+        t1 = monotonic_now();
+
+        pthread_barrier_destroy(&run.start);
+    }
+
+    blocking_q_destroy(&q);
+
+    return 2.0 * (double) tasks * 1e9 / (double) (t1 - t0);
+}
+
+int main(int argc, char **argv) {
+    static const struct {
+        const char *name;
+        blocking_q_kind kind;
+    } kinds[] = {{"ring", BLOCKING_Q_RING}, {"mpmc", BLOCKING_Q_MPMC}, {"list", BLOCKING_Q_LIST}};
+
+    int max_threads = argc > 1 ? atoi(argv[1]) : BENCH_MAX_THREADS;
+    long tasks = argc > 2 ? atol(argv[2]) : BENCH_TASKS;
+
+    if (max_threads < 1 || max_threads > BENCH_MAX_THREADS || tasks < 1) {
+        fprintf(stderr, "usage: %s [max threads, 1 to %d] [tasks]\n", argv[0], BENCH_MAX_THREADS);
+        return EXIT_FAILURE;
+    }
+
+    printf("%8s", "threads");
+    for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); ++k) printf("%14s", kinds[k].name);
+    printf("   (Mops/s)\n");
+
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        printf("%8d", threads);
+
+        for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); ++k)
+            printf("%14.2f", bench_kind(kinds[k].kind, threads, tasks) / 1e6);
+
+        printf("\n");
+        fflush(stdout);
+    }
+
+    return EXIT_SUCCESS;
+}
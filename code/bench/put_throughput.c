@@ -0,0 +1,41 @@
+/*
+ * Put throughput of a BLOCKING_Q_LIST queue, one thread: time to put
+ * 10k, 100k and 1M tasks, then to take them back.
+ *
+ * From code/:
+ *   gcc -O2 -o /tmp/put_throughput bench/put_throughput.c blocking_q.c monotonic.c -lpthread
+ *   /tmp/put_throughput
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "../blocking_q.h"
+#include "../monotonic.h"
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
+
+int main(void) {
+    static const long sizes[] = {10 * 1000, 100 * 1000, 1000 * 1000};
+    static task tk;
+
+    printf("%10s %12s %12s %12s\n", "puts", "put ms", "get ms", "Mputs/s");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        blocking_q q;
+
+        if (!blocking_q_init(&q)) return EXIT_FAILURE;
+
+        long t0 = monotonic_now();
+        for (long i = 0; i < sizes[s]; ++i) blocking_q_put(&q, &tk);
+        long t1 = monotonic_now();
+        for (long i = 0; i < sizes[s]; ++i) blocking_q_get(&q);
+        long t2 = monotonic_now();
+
+        printf("%10ld %12.2f %12.2f %12.1f\n", sizes[s], (t1 - t0) / 1e6, (t2 - t1) / 1e6,
+               (double) sizes[s] * 1e3 / (double) (t1 - t0));
+
+        blocking_q_destroy(&q);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,178 @@
+/*
+ * Stress test of the queue kinds: producers put every task once, with
+ * put and put_many, consumers take with get, drain and
+ * drain_at_least until the queue is closed and empty, and peek in
+ * between, which must only ever see one of the tasks. Every task must
+ * come out exactly once, and in order for BLOCKING_Q_SPSC, which runs
+ * one producer and one consumer. Meant to run under TSan.
+ *
+ * From code/:
+ *   gcc -D_GNU_SOURCE -O1 -g -fsanitize=thread -o /tmp/q_stress bench/q_stress.c blocking_q.c -lpthread
+ *   /tmp/q_stress [producers, 3] [consumers, 3]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "../blocking_q.h"
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
+
+#define STRESS_TASKS (200 * 1000)
+#define STRESS_CAPACITY 64
+#define STRESS_BATCH 37
+#define STRESS_MAX_THREADS 16
+
+task tasks[STRESS_TASKS];
+_Atomic int seen[STRESS_TASKS];
+
+typedef struct stress_worker {
+    blocking_q *q;
+    long first;
+    long last;
+    bool ordered;
+    bool failed;
+} stress_worker;
+
+/**
+ * Puts the tasks from `first` to `last`, excluded, alternating single
+ * puts and batches.
+ * @param v_worker the worker
+ * @return NULL
+ */
+void *stress_produce(void *v_worker) {
+    stress_worker *w = (stress_worker *) v_worker;
+    task_ptr batch[STRESS_BATCH];
+
+    for (long i = w->first; i < w->last;) {
+        if (i & 1) {
+            blocking_q_put(w->q, tasks + i++);
+            continue;
+        }
+
+        size_t n = 0;
+        while (n < STRESS_BATCH && i < w->last) batch[n++] = tasks + i++;
+        blocking_q_put_many(w->q, batch, n);
+    }
+
+    return NULL;
+}
+
+/**
+ * Marks a task as seen.
+ * @param w the worker
+ * @param t the task
+ * @param expected the next task in order, only checked if ordered
+ */
+void stress_check(stress_worker *w, task_ptr t, long *expected) {
+    long i = t - tasks;
+
+    if (i < 0 || i >= STRESS_TASKS || 0 != atomic_fetch_add(seen + i, 1)) w->failed = true;
+    if (w->ordered && i != (*expected)++) w->failed = true;
+}
+
+/**
+ * Takes tasks until the queue is closed and empty, cycling between
+ * get, drain and drain_at_least, with a peek before each.
+ * @param v_worker the worker
+ * @return NULL
+ */
+void *stress_consume(void *v_worker) {
+    stress_worker *w = (stress_worker *) v_worker;
+    task_ptr batch[STRESS_BATCH];
+    long expected = 0;
+
+    for (unsigned round = 0;; ++round) {
+        task_ptr peeked;
+        size_t n;
+
+        if (blocking_q_peek(w->q, &peeked) && (peeked < tasks || peeked >= tasks + STRESS_TASKS)) w->failed = true;
+
+        switch (round % 3) {
+            case 0:
+                batch[0] = blocking_q_get(w->q);
+                n = NULL != batch[0];
+                break;
+            case 1:
+                n = blocking_q_drain(w->q, batch, STRESS_BATCH);
+                break;
+            default:
+                n = blocking_q_drain_at_least(w->q, batch, STRESS_BATCH, 5);
+                break;
+        }
+
+        if (n > STRESS_BATCH) w->failed = true;
+        for (size_t k = 0; k < n; ++k) stress_check(w, batch[k], &expected);
+
+        if (0 == n && blocking_q_is_closed(w->q) && 0 == blocking_q_size(w->q)) break;
+    }
+
+    return NULL;
+}
+
+/**
+ * Runs the stress test on one kind.
+ * @param kind the queue kind
+ * @param producers the producer count
+ * @param consumers the consumer count
+ * @return whether every task came out once
+ */
+bool stress_kind(blocking_q_kind kind, int producers, int consumers) {
+    blocking_q q;
+    pthread_t ids[2 * STRESS_MAX_THREADS];
+    stress_worker workers[2 * STRESS_MAX_THREADS];
+    bool ok = true;
+
+    if (BLOCKING_Q_SPSC == kind) producers = consumers = 1;
+    if (!blocking_q_init_with(&q, kind, STRESS_CAPACITY)) return false;
+    for (long i = 0; i < STRESS_TASKS; ++i) atomic_store(seen + i, 0);
+
+    for (int i = 0; i < producers; ++i) {
+        workers[i] = (stress_worker) {&q, STRESS_TASKS * i / producers, STRESS_TASKS * (i + 1) / producers, false, false};
+        pthread_create(ids + i, NULL, stress_produce, workers + i);
+    }
+    for (int i = producers; i < producers + consumers; ++i) {
+        workers[i] = (stress_worker) {&q, 0, 0, BLOCKING_Q_SPSC == kind, false};
+        pthread_create(ids + i, NULL, stress_consume, workers + i);
+    }
+
+    for (int i = 0; i < producers; ++i) pthread_join(ids[i], NULL);
+    blocking_q_close(&q);
+    for (int i = producers; i < producers + consumers; ++i) {
+        pthread_join(ids[i], NULL);
+        ok = ok && !workers[i].failed;
+    }
+
+    for (long i = 0; i < STRESS_TASKS; ++i) ok = ok && 1 == atomic_load(seen + i);
+
+    blocking_q_destroy(&q);
+
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    static const struct {
+        const char *name;
+        blocking_q_kind kind;
+    } kinds[] = {{"list", BLOCKING_Q_LIST}, {"ring", BLOCKING_Q_RING}, {"mpmc", BLOCKING_Q_MPMC},
+                 {"spsc", BLOCKING_Q_SPSC}, {"heap", BLOCKING_Q_HEAP}};
+
+    int producers = argc > 1 ? atoi(argv[1]) : 3;
+    int consumers = argc > 2 ? atoi(argv[2]) : 3;
+    bool ok = true;
+
+    if (producers < 1 || producers > STRESS_MAX_THREADS || consumers < 1 || consumers > STRESS_MAX_THREADS) {
+        fprintf(stderr, "usage: %s [producers] [consumers], 1 to %d each\n", argv[0], STRESS_MAX_THREADS);
+        return EXIT_FAILURE;
+    }
+
+    for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); ++k) {
+        bool kind_ok = stress_kind(kinds[k].kind, producers, consumers);
+
+        printf("%s: %s\n", kinds[k].name, kind_ok ? "ok" : "FAILED");
+        ok = ok && kind_ok;
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
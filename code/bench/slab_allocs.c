@@ -0,0 +1,74 @@
+/*
+ * Allocations and time of a BLOCKING_Q_LIST queue for BENCH_TASKS
+ * put/get pairs: first in the same thread, then with a producer and a
+ * consumer thread. malloc is counted by wrapping it at link time.
+ *
+ * From code/:
+ *   gcc -O2 -o /tmp/slab_allocs bench/slab_allocs.c blocking_q.c monotonic.c -lpthread -Wl,--wrap=malloc
+ *   /tmp/slab_allocs
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "../blocking_q.h"
+#include "../monotonic.h"
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
+
+#define BENCH_TASKS (1000 * 1000)
+
+_Atomic long mallocs;
+task tk;
+
+void *__real_malloc(size_t size); // NOLINT(bugprone-reserved-identifier)
+
+/**
+ * Counts the call, then allocates.
+ * @param size the size
+ * @return the allocation
+ */
+void *__wrap_malloc(size_t size) { // NOLINT(bugprone-reserved-identifier)
+    atomic_fetch_add_explicit(&mallocs, 1, memory_order_relaxed);
+    return __real_malloc(size);
+}
+
+/**
+ * Puts BENCH_TASKS tasks.
+ * @param v_q the queue
+ * @return NULL
+ */
+void *bench_produce(void *v_q) {
+    for (long i = 0; i < BENCH_TASKS; ++i) blocking_q_put((blocking_q *) v_q, &tk);
+    return NULL;
+}
+
+int main(void) {
+    blocking_q q;
+
+    if (!blocking_q_init(&q)) return EXIT_FAILURE;
+
+    atomic_store(&mallocs, 0);
+    long t0 = monotonic_now();
+    for (long i = 0; i < BENCH_TASKS; ++i) {
+        blocking_q_put(&q, &tk);
+        blocking_q_get(&q);
+    }
+    long t1 = monotonic_now();
+    printf("same thread:        %8ld mallocs %8.1f ms\n", atomic_load(&mallocs), (t1 - t0) / 1e6);
+
+    pthread_t producer;
+
+    atomic_store(&mallocs, 0);
+    t0 = monotonic_now();
+    pthread_create(&producer, NULL, bench_produce, &q);
+    for (long i = 0; i < BENCH_TASKS; ++i) blocking_q_get(&q);
+    pthread_join(producer, NULL);
+    t1 = monotonic_now();
+    printf("producer+consumer:  %8ld mallocs %8.1f ms\n", atomic_load(&mallocs), (t1 - t0) / 1e6);
+
+    blocking_q_destroy(&q);
+
+    return EXIT_SUCCESS;
+}
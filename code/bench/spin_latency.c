@@ -0,0 +1,89 @@
+/*
+ * Handoff latency of a BLOCKING_Q_SPSC queue when the consumer is
+ * mostly waiting: the producer puts a task every BENCH_GAP_NS, the
+ * consumer measures how long after the put it got it.
+ *
+ * From code/:
+ *   gcc -O2 -o /tmp/spin_latency bench/spin_latency.c blocking_q.c monotonic.c -lpthread
+ *   /tmp/spin_latency [spin max, 0] [force]
+ *
+ * blocking_q_set_spin turns spinning off on a single CPU, `force`
+ * bypasses that to measure what spinning would cost there.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "../blocking_q.h"
+#include "../monotonic.h"
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
+
+#define BENCH_TASKS (20 * 1000)
+#define BENCH_GAP_NS 2000
+#define BENCH_CAPACITY 64
+
+task tasks[BENCH_TASKS];
+long latencies[BENCH_TASKS];
+
+/**
+ * Puts a task every BENCH_GAP_NS, stamped with the time of the put.
+ * @param v_q the queue
+ * @return NULL
+ */
+void *bench_produce(void *v_q) {
+    for (long i = 0; i < BENCH_TASKS; ++i) {
+        long t0 = monotonic_now();
+        while (monotonic_now() - t0 < BENCH_GAP_NS);
+
+        tasks[i].start = monotonic_now();
+        blocking_q_put((blocking_q *) v_q, tasks + i);
+    }
+
+    return NULL;
+}
+
+/**
+ * Order of two latencies, for qsort.
+ * @param a the first latency
+ * @param b the second latency
+ * @return negative, zero or positive as a is lower, equal or higher
+ */
+int bench_compare(const void *a, const void *b) {
+    long x = *(const long *) a, y = *(const long *) b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+    size_t spin_max = argc > 1 ? strtoul(argv[1], NULL, 10) : 0;
+    bool force = argc > 2 && 0 == strcmp(argv[2], "force");
+    blocking_q q;
+
+    if (!blocking_q_init_with(&q, BLOCKING_Q_SPSC, BENCH_CAPACITY)) return EXIT_FAILURE;
+
+    blocking_q_set_spin(&q, spin_max);
+    if (force) {
+        q.spin_max = spin_max;
+        atomic_store(&q.spin_budget, spin_max);
+    }
+
+    pthread_t producer;
+    pthread_create(&producer, NULL, bench_produce, &q);
+
+    for (long i = 0; i < BENCH_TASKS; ++i) {
+        task_ptr t = blocking_q_get(&q);
+        latencies[i] = monotonic_now() - t->start;
+    }
+
+    pthread_join(producer, NULL);
+    blocking_q_destroy(&q);
+
+    qsort(latencies, BENCH_TASKS, sizeof(long), bench_compare);
+    printf("spin max %zu%s: p50 %.1f us p99 %.1f us max %.1f us\n", spin_max, force ? " (forced)" : "",
+           latencies[BENCH_TASKS / 2] / 1e3, latencies[BENCH_TASKS * 99 / 100] / 1e3,
+           latencies[BENCH_TASKS - 1] / 1e3);
+
+    return EXIT_SUCCESS;
+}
@@ -1,66 +1,1158 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
 #include <pthread.h>
+#ifdef __linux__
+#include <errno.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
 #include "blocking_q.h"
 
-#pragma clang diagnostic push
-#pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
+
+#define TODO printf("TODO!\n");
+
+// One parked thread in `waiters` or `put_waiters`, the low bits count
+// the wakeups not taken yet
+#define PARKED ((uint64_t) 1 << 32)
+
+// Spinning consumers never give up after fewer spins than this, and
+// yield this many times before parking.
+#define SPIN_MIN 16
+#define SPIN_YIELDS 4
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define CPU_RELAX() __asm__ __volatile__("yield")
+#else
+#define CPU_RELAX()
+#endif
+
+
+/**
+ * Internal function to blocking_q. Allocates a slab of nodes for a
+ * list and chains them together. The caller must own `slabs`.
+ * @param q the queue
+ * @return the first node of the chain, NULL if no memory is available
+ */
+blocking_q_node *__blocking_q_slab_new(blocking_q *q) { // NOLINT(bugprone-reserved-identifier)
+
+    blocking_q_slab *slab = malloc(sizeof(blocking_q_slab));
+    if (slab == NULL) return NULL;
+
+    for (size_t i = 0; i + 1 < BLOCKING_Q_SLAB_NODES; ++i)
+        slab->nodes[i].next = slab->nodes + i + 1;
+    slab->nodes[BLOCKING_Q_SLAB_NODES - 1].next = NULL;
+
+    slab->next = q->slabs;
+    q->slabs = slab;
+
+    return slab->nodes;
+}
+
+/**
+ * Internal function to blocking_q. Releases every slab of a list.
+ * @param q the queue
+ */
+void __blocking_q_slabs_free(blocking_q *q) { // NOLINT(bugprone-reserved-identifier)
+
+    blocking_q_slab *curr = q->slabs;
+    blocking_q_slab *next;
+
+    while (curr != NULL) {
+        next = curr->next;
+        free(curr);
+        curr = next;
+    }
+
+    q->slabs = NULL;
+}
+
+/**
+ * Internal function to blocking_q. Gets a node for a list from the
+ * producers' cache, refilling it from the nodes freed by consumers
+ * or from a new slab. The caller must hold `tail_lock`.
+ * @param q the queue
+ * @return the node, NULL if no memory is available
+ */
+blocking_q_node *__blocking_q_node_alloc(blocking_q *q) { // NOLINT(bugprone-reserved-identifier)
+
+    if (q->put_cache == NULL) {
+        pthread_mutex_lock(&q->pool_lock);
+
+        q->put_cache = q->free_nodes;
+        q->free_nodes = NULL;
+
+        if (q->put_cache == NULL)
+            q->put_cache = __blocking_q_slab_new(q);
+
+        pthread_mutex_unlock(&q->pool_lock);
+
+        if (q->put_cache == NULL) return NULL;
+    }
+
+    blocking_q_node *node = q->put_cache;
+    q->put_cache = node->next;
+
+    return node;
+}
+
+/**
+ * Internal function to blocking_q. Gives a node back to the consumers'
+ * cache, which is handed over to producers once a slab worth of nodes
+ * was freed. The caller must hold `lock`.
+ * @param q the queue
+ * @param node the unlinked node
+ */
+void __blocking_q_node_free(blocking_q *q, blocking_q_node *node) { // NOLINT(bugprone-reserved-identifier)
+
+    node->next = q->take_cache;
+    q->take_cache = node;
+    if (q->take_cached++ == 0) q->take_cache_last = node;
+
+    if (q->take_cached < BLOCKING_Q_SLAB_NODES) return;
+
+    pthread_mutex_lock(&q->pool_lock);
+    q->take_cache_last->next = q->free_nodes;
+    q->free_nodes = q->take_cache;
+    pthread_mutex_unlock(&q->pool_lock);
+
+    q->take_cache = NULL;
+    q->take_cache_last = NULL;
+    q->take_cached = 0;
+}
+
+/**
+ * Internal function to blocking_q. Appends an element to a list.
+ * @param q the queue
+ * @param data the element
+ * @return if the element was added, false if no memory is available
+ * for a new entry
+ */
+bool __blocking_q_list_add(blocking_q *q, task_ptr data) { // NOLINT(bugprone-reserved-identifier)
+
+    pthread_mutex_lock(&q->tail_lock);
+
+    blocking_q_node *new_node = __blocking_q_node_alloc(q);
+    // error with malloc ->
+    if (new_node == NULL) {
+        pthread_mutex_unlock(&q->tail_lock);
+        return false;
+    }
+
+    new_node->data = data;
+    new_node->next = NULL;
+
+    q->last->next = new_node;
+    q->last = new_node;
+
+    // publishing the size after linking lets consumers trust
+    // `first->next` as soon as they observe a non-zero size
+    atomic_fetch_add(&q->sz, 1);
+
+    pthread_mutex_unlock(&q->tail_lock);
+
+    return true;
+}
+
+/**
+ * Internal function to blocking_q. Appends a chain of elements to a
+ * list with a single hold of `tail_lock`. Either all elements are
+ * added or none.
+ * @param q the queue
+ * @param data the elements
+ * @param n the amount of elements
+ * @return the amount of elements added, 0 if no memory is available
+ * for the new entries
+ */
+size_t __blocking_q_list_add_many(blocking_q *q, task_ptr *data, size_t n) { // NOLINT(bugprone-reserved-identifier)
+
+    pthread_mutex_lock(&q->tail_lock);
+
+    // build the chain aside, `last` is only moved once it is complete
+    blocking_q_node *chain = NULL;
+    blocking_q_node *chain_last = NULL;
+
+    for (size_t i = 0; i < n; ++i) {
+        blocking_q_node *new_node = __blocking_q_node_alloc(q);
+
+        // error with malloc -> give the chain back to the cache
+        if (new_node == NULL) {
+            if (chain_last != NULL) {
+                chain_last->next = q->put_cache;
+                q->put_cache = chain;
+            }
+            pthread_mutex_unlock(&q->tail_lock);
+            return 0;
+        }
+
+        new_node->data = data[i];
+        new_node->next = NULL;
+
+        if (chain_last == NULL) chain = new_node;
+        else chain_last->next = new_node;
+        chain_last = new_node;
+    }
+
+    if (chain_last != NULL) {
+        q->last->next = chain;
+        q->last = chain_last;
+        atomic_fetch_add(&q->sz, n);
+    }
+
+    pthread_mutex_unlock(&q->tail_lock);
+
+    return n;
+}
+
+/**
+ * Internal function to blocking_q. Takes the first element of a list.
+ * @param q the queue
+ * @param data where to store the element
+ * @return if an element was taken, false if the list was empty
+ */
+bool __blocking_q_list_take(blocking_q *q, task_ptr *data) { // NOLINT(bugprone-reserved-identifier)
+
+    pthread_mutex_lock(&q->lock);
+
+    if (atomic_load(&q->sz) == 0) {
+        pthread_mutex_unlock(&q->lock);
+        return false;
+    }
+
+    // the first node is a dummy, the element lives in the next one
+    // which becomes the new dummy
+    blocking_q_node *first = q->first;
+    blocking_q_node *next = first->next;
+    *data = next->data;
+
+    next->data = NULL;
+    q->first = next;
+    atomic_fetch_sub(&q->sz, 1);
+
+    __blocking_q_node_free(q, first);
+
+    pthread_mutex_unlock(&q->lock);
+
+    return true;
+}
+
+/**
+ * Internal function to blocking_q. Takes up to `n` elements of a list
+ * with a single hold of `lock`.
+ * @param q the queue
+ * @param data where to store the elements
+ * @param n the maximum amount of elements to take
+ * @return the amount of elements taken
+ */
+size_t __blocking_q_list_take_many(blocking_q *q, task_ptr *data, size_t n) { // NOLINT(bugprone-reserved-identifier)
+
+    pthread_mutex_lock(&q->lock);
+
+    size_t available = atomic_load(&q->sz);
+    if (n > available) n = available;
+
+    for (size_t i = 0; i < n; ++i) {
+        blocking_q_node *first = q->first;
+        blocking_q_node *next = first->next;
+        data[i] = next->data;
+
+        next->data = NULL;
+        q->first = next;
+        __blocking_q_node_free(q, first);
+    }
+
+    atomic_fetch_sub(&q->sz, n);
+
+    pthread_mutex_unlock(&q->lock);
+
+    return n;
+}
+
+/**
+ * Internal function to blocking_q. Appends an element to a ring.
+ * @param q the queue
+ * @param data the element
+ * @return if the element was added, false if the ring was full
+ */
+bool __blocking_q_ring_add(blocking_q *q, task_ptr data) { // NOLINT(bugprone-reserved-identifier)
+
+    pthread_mutex_lock(&q->lock);
+
+    bool added = atomic_load(&q->sz) < q->capacity;
+    if (added) {
+        q->ring[q->tail++ & (q->capacity - 1)] = data;
+        atomic_fetch_add(&q->sz, 1);
+    }
+
+    pthread_mutex_unlock(&q->lock);
+
+    return added;
+}
+
+/**
+ * Internal function to blocking_q. Appends as many elements as there
+ * is room for in a ring with a single hold of `lock`.
+ * @param q the queue
+ * @param data the elements
+ * @param n the amount of elements
+ * @return the amount of elements added
+ */
+size_t __blocking_q_ring_add_many(blocking_q *q, task_ptr *data, size_t n) { // NOLINT(bugprone-reserved-identifier)
+
+    pthread_mutex_lock(&q->lock);
+
+    size_t room = q->capacity - atomic_load(&q->sz);
+    if (n > room) n = room;
+
+    for (size_t i = 0; i < n; ++i)
+        q->ring[q->tail++ & (q->capacity - 1)] = data[i];
+    atomic_fetch_add(&q->sz, n);
+
+    pthread_mutex_unlock(&q->lock);
+
+    return n;
+}
+
+/**
+ * Internal function to blocking_q. Takes the first element of a ring.
+ * @param q the queue
+ * @param data where to store the element
+ * @return if an element was taken, false if the ring was empty
+ */
+bool __blocking_q_ring_take(blocking_q *q, task_ptr *data) { // NOLINT(bugprone-reserved-identifier)
+
+    pthread_mutex_lock(&q->lock);
+
+    bool taken = atomic_load(&q->sz) > 0;
+    if (taken) {
+        *data = q->ring[q->head++ & (q->capacity - 1)];
+        atomic_fetch_sub(&q->sz, 1);
+    }
+
+    pthread_mutex_unlock(&q->lock);
+
+    return taken;
+}
+
+/**
+ * Internal function to blocking_q. Takes up to `n` elements of a ring
+ * with a single hold of `lock`.
+ * @param q the queue
+ * @param data where to store the elements
+ * @param n the maximum amount of elements to take
+ * @return the amount of elements taken
+ */
+size_t __blocking_q_ring_take_many(blocking_q *q, task_ptr *data, size_t n) { // NOLINT(bugprone-reserved-identifier)
+
+    pthread_mutex_lock(&q->lock);
+
+    size_t available = atomic_load(&q->sz);
+    if (n > available) n = available;
+
+    for (size_t i = 0; i < n; ++i)
+        data[i] = q->ring[q->head++ & (q->capacity - 1)];
+    atomic_fetch_sub(&q->sz, n);
+
+    pthread_mutex_unlock(&q->lock);
+
+    return n;
+}
+
+/**
+ * Internal function to blocking_q. Orders two entries of a heap.
+ * @return if `a` must come out before `b`
+ */
+bool __blocking_q_heap_before(blocking_q_heap_entry *a, blocking_q_heap_entry *b) { // NOLINT(bugprone-reserved-identifier)
+    return a->key < b->key || (a->key == b->key && a->seq < b->seq);
+}
+
+/**
+ * Internal function to blocking_q. Appends as many elements as there
+ * is room for in a heap with a single hold of `lock`. Each element
+ * sifts up from the last slot.
+ * @param q the queue
+ * @param data the elements
+ * @param n the amount of elements
+ * @return the amount of elements added
+ */
+size_t __blocking_q_heap_add_many(blocking_q *q, task_ptr *data, size_t n) { // NOLINT(bugprone-reserved-identifier)
+
+    pthread_mutex_lock(&q->lock);
+
+    size_t sz = atomic_load(&q->sz);
+    if (n > q->capacity - sz) n = q->capacity - sz;
+
+    for (size_t i = 0; i < n; ++i) {
+        blocking_q_heap_entry entry = {
+                .key = q->key == NULL ? 0 : q->key(data[i]),
+                .seq = q->heap_seq++,
+                .data = data[i],
+        };
+
+        size_t pos = sz++;
+        while (pos > 0) {
+            size_t parent = (pos - 1) / 2;
+            if (!__blocking_q_heap_before(&entry, q->heap + parent)) break;
+
+            q->heap[pos] = q->heap[parent];
+            pos = parent;
+        }
+        q->heap[pos] = entry;
+    }
+
+    atomic_store(&q->sz, sz);
+
+    pthread_mutex_unlock(&q->lock);
+
+    return n;
+}
+
+/**
+ * Internal function to blocking_q. Takes up to `n` elements of a heap,
+ * lowest key first, with a single hold of `lock`. The last entry
+ * sifts down from the root each time.
+ * @param q the queue
+ * @param data where to store the elements
+ * @param n the maximum amount of elements to take
+ * @return the amount of elements taken
+ */
+size_t __blocking_q_heap_take_many(blocking_q *q, task_ptr *data, size_t n) { // NOLINT(bugprone-reserved-identifier)
+
+    pthread_mutex_lock(&q->lock);
+
+    size_t sz = atomic_load(&q->sz);
+    if (n > sz) n = sz;
+
+    for (size_t i = 0; i < n; ++i) {
+        data[i] = q->heap[0].data;
+
+        blocking_q_heap_entry last = q->heap[--sz];
+        size_t pos = 0;
+
+        for (;;) {
+            size_t child = 2 * pos + 1;
+            if (child >= sz) break;
+            if (child + 1 < sz && __blocking_q_heap_before(q->heap + child + 1, q->heap + child))
+                child++;
+            if (!__blocking_q_heap_before(q->heap + child, &last)) break;
+
+            q->heap[pos] = q->heap[child];
+            pos = child;
+        }
+        q->heap[pos] = last;
+    }
+
+    atomic_store(&q->sz, sz);
+
+    pthread_mutex_unlock(&q->lock);
+
+    return n;
+}
+
+/**
+ * Internal function to blocking_q. Appends an element to a lock-free
+ * queue. The producer owns the cell once it moved `enqueue_pos` past
+ * it and hands it over to consumers by bumping the sequence number.
+ * @param q the queue
+ * @param data the element
+ * @return if the element was added, false if the queue was full
+ */
+bool __blocking_q_mpmc_add(blocking_q *q, task_ptr data) { // NOLINT(bugprone-reserved-identifier)
+
+    size_t pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+    blocking_q_cell *cell;
+
+    for (;;) {
+        cell = q->cells + (pos & (q->capacity - 1));
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+        if (diff == 0) {
+            // the cell is free for this lap, try to claim it
+            if (atomic_compare_exchange_weak(&q->enqueue_pos, &pos, pos + 1))
+                break;
+        } else if (diff < 0) {
+            // the consumers did not free this cell yet
+            return false;
+        } else {
+            pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    atomic_store_explicit(&cell->data, data, memory_order_relaxed);
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+
+    return true;
+}
+
+/**
+ * Internal function to blocking_q. Takes the first element of a
+ * lock-free queue and frees its cell for the next lap of producers.
+ * @param q the queue
+ * @param data where to store the element
+ * @return if an element was taken, false if the queue was empty
+ */
+bool __blocking_q_mpmc_take(blocking_q *q, task_ptr *data) { // NOLINT(bugprone-reserved-identifier)
+
+    size_t pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+    blocking_q_cell *cell;
+
+    for (;;) {
+        cell = q->cells + (pos & (q->capacity - 1));
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak(&q->dequeue_pos, &pos, pos + 1))
+                break;
+        } else if (diff < 0) {
+            // the producer of this cell did not publish yet
+            return false;
+        } else {
+            pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+        }
+    }
+
+    *data = atomic_load_explicit(&cell->data, memory_order_relaxed);
+    atomic_store_explicit(&cell->seq, pos + q->capacity, memory_order_release);
+
+    return true;
+}
+
+/**
+ * Internal function to blocking_q. Appends an element to a
+ * single-producer ring. Only the producer thread may call this.
+ * @param q the queue
+ * @param data the element
+ * @return if the element was added, false if the ring was full
+ */
+bool __blocking_q_spsc_add(blocking_q *q, task_ptr data) { // NOLINT(bugprone-reserved-identifier)
+
+    size_t tail = atomic_load_explicit(&q->spsc_tail, memory_order_relaxed);
+
+    // only read the consumer's line again when the ring looks full
+    if (tail - q->cached_head >= q->capacity) {
+        q->cached_head = atomic_load_explicit(&q->spsc_head, memory_order_acquire);
+        if (tail - q->cached_head >= q->capacity) return false;
+    }
+
+    q->ring[tail & (q->capacity - 1)] = data;
+
+    // sequentially consistent so that it is ordered before the
+    // load of `waiters` in __blocking_q_add
+    atomic_store(&q->spsc_tail, tail + 1);
+
+    return true;
+}
+
+/**
+ * Internal function to blocking_q. Appends as many elements as there
+ * is room for in a single-producer ring and publishes them with a
+ * single store of the tail. Only the producer thread may call this.
+ * @param q the queue
+ * @param data the elements
+ * @param n the amount of elements
+ * @return the amount of elements added
+ */
+size_t __blocking_q_spsc_add_many(blocking_q *q, task_ptr *data, size_t n) { // NOLINT(bugprone-reserved-identifier)
+
+    size_t tail = atomic_load_explicit(&q->spsc_tail, memory_order_relaxed);
+
+    if (q->capacity - (tail - q->cached_head) < n)
+        q->cached_head = atomic_load_explicit(&q->spsc_head, memory_order_acquire);
+
+    size_t room = q->capacity - (tail - q->cached_head);
+    if (n > room) n = room;
+    if (n == 0) return 0;
+
+    for (size_t i = 0; i < n; ++i)
+        q->ring[(tail + i) & (q->capacity - 1)] = data[i];
+
+    atomic_store(&q->spsc_tail, tail + n);
+
+    return n;
+}
+
+/**
+ * Internal function to blocking_q. Takes up to `n` elements from a
+ * single-consumer ring and frees their slots with a single store of
+ * the head. Only the consumer thread may call this.
+ * @param q the queue
+ * @param data where to store the elements
+ * @param n the maximum amount of elements to take
+ * @return the amount of elements taken
+ */
+size_t __blocking_q_spsc_take_many(blocking_q *q, task_ptr *data, size_t n) { // NOLINT(bugprone-reserved-identifier)
+
+    size_t head = atomic_load_explicit(&q->spsc_head, memory_order_relaxed);
+
+    // only read the producer's line again when the ring looks empty
+    if (q->cached_tail - head < n)
+        q->cached_tail = atomic_load_explicit(&q->spsc_tail, memory_order_acquire);
+
+    size_t available = q->cached_tail - head;
+    if (n > available) n = available;
+    if (n == 0) return 0;
+
+    for (size_t i = 0; i < n; ++i)
+        data[i] = q->ring[(head + i) & (q->capacity - 1)];
+
+    atomic_store(&q->spsc_head, head + n);
+
+    return n;
+}
+
+/**
+ * Internal function to blocking_q. Takes the first element of a
+ * single-consumer ring.
+ * @param q the queue
+ * @param data where to store the element
+ * @return if an element was taken, false if the ring was empty
+ */
+bool __blocking_q_spsc_take(blocking_q *q, task_ptr *data) { // NOLINT(bugprone-reserved-identifier)
+    return __blocking_q_spsc_take_many(q, data, 1) == 1;
+}
+
+#ifdef __linux__
+/**
+ * Internal function to blocking_q. Sleeps on a futex word as long as
+ * it holds the value seen before deciding to park.
+ * @param word the sequence counter
+ * @param seen the value read before checking the queue
+ * @param deadline the CLOCK_MONOTONIC time when to give up, NULL to
+ * wait as long as needed
+ * @return false if the deadline passed
+ */
+bool __blocking_q_futex_wait(_Atomic uint32_t *word, uint32_t seen, const struct timespec *deadline) { // NOLINT(bugprone-reserved-identifier)
+
+    // the bitset variant takes an absolute timeout on the monotonic clock
+    long rc = syscall(SYS_futex, (uint32_t *) word, FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG,
+                      seen, deadline, NULL, FUTEX_BITSET_MATCH_ANY);
+
+    return rc == 0 || errno != ETIMEDOUT;
+}
+
+/**
+ * Internal function to blocking_q. Wakes up to `n` of the threads
+ * parked on a futex word that no earlier wakeup is meant for.
+ * Parked threads stay counted until they leave the wait, and the
+ * wakeups they did not take yet are counted along with them, so the
+ * producers that come before a woken thread runs skip the syscall.
+ * Both counts share one word so that a thread leaving is never seen
+ * half gone.
+ * @param word the sequence counter
+ * @param waiters the parked threads and their pending wakeups
+ * @param n the most threads to wake
+ */
+void __blocking_q_futex_wake(_Atomic uint32_t *word, _Atomic uint64_t *waiters, size_t n) { // NOLINT(bugprone-reserved-identifier)
+
+    uint64_t curr = atomic_load(waiters);
+    uint64_t wake;
+
+    do {
+        uint64_t idle = curr / PARKED - curr % PARKED;
+        if (idle == 0 || n == 0) return;
+
+        wake = n < idle ? n : idle;
+    } while (!atomic_compare_exchange_weak(waiters, &curr, curr + wake));
+
+    // threads about to sleep read the word before being counted
+    atomic_fetch_add(word, 1);
+
+    syscall(SYS_futex, (uint32_t *) word, FUTEX_WAKE | FUTEX_PRIVATE_FLAG,
+            (int) wake, NULL, NULL, 0);
+}
+
+/**
+ * Internal function to blocking_q. Leaves the wait on a futex word,
+ * whatever ended it, taking a pending wakeup along if any. A thread
+ * that was not woken may take the wakeup of another one, which at
+ * worst makes one wakeup too many later.
+ * @param waiters the parked threads and their pending wakeups
+ */
+void __blocking_q_futex_leave(_Atomic uint64_t *waiters) { // NOLINT(bugprone-reserved-identifier)
+
+    uint64_t curr = atomic_load(waiters);
+    while (!atomic_compare_exchange_weak(waiters, &curr, curr - PARKED - (curr % PARKED != 0)));
+}
+#endif
+
+/**
+ * Internal function to blocking_q. Wakes enough parked consumers for
+ * `n` new elements with a single wakeup.
+ * @param q the queue
+ * @param n the amount of elements just added
+ */
+void __blocking_q_wake_consumers(blocking_q *q, size_t n) { // NOLINT(bugprone-reserved-identifier)
+
+    // a consumer counts itself as a waiter before checking the size
+    // one last time, so either it sees the elements or we see it
+    if (n == 0 || atomic_load(&q->waiters) == 0) return;
 
-#define TODO printf("TODO!\n");
+#ifdef __linux__
+    __blocking_q_futex_wake(&q->elements_seq, &q->waiters, n);
+#else
+    pthread_mutex_lock(&q->park_lock);
+
+    size_t waiters = (size_t) (atomic_load(&q->waiters) / PARKED);
+    if (n >= waiters) {
+        pthread_cond_broadcast(&q->cond);
+    } else {
+        for (size_t i = 0; i < n; ++i)
+            pthread_cond_signal(&q->cond);
+    }
 
+    pthread_mutex_unlock(&q->park_lock);
+#endif
+}
 
 /**
- * Internal function to blocking_q. Takes an element
- * in the queue. This functions assumes the following
- * preconditions:
- *  - The thread has safe access to the queue
- *  - The queue is NOT empty
- * Also update the size.
+ * Internal function to blocking_q. Wakes parked producers once
+ * `n` slots were freed in a bounded queue.
  * @param q the queue
- * @return an element
+ * @param n the amount of elements just taken
  */
-task_ptr __blocking_q_take(blocking_q *q) { // NOLINT(bugprone-reserved-identifier)
+void __blocking_q_wake_producers(blocking_q *q, size_t n) { // NOLINT(bugprone-reserved-identifier)
 
-    // actualise
-    blocking_q_node *first = q->first;
-    task_ptr data = first->data;
+    if (n == 0 || atomic_load(&q->put_waiters) == 0) return;
+
+#ifdef __linux__
+    __blocking_q_futex_wake(&q->room_seq, &q->put_waiters, n);
+#else
+    pthread_mutex_lock(&q->park_lock);
+    if (n == 1) pthread_cond_signal(&q->not_full);
+    else pthread_cond_broadcast(&q->not_full);
+    pthread_mutex_unlock(&q->park_lock);
+#endif
+}
+
+/**
+ * Internal function to blocking_q. Adds an element whatever the kind
+ * of the queue and wakes a consumer if one is parked. Does not block.
+ * @param q the queue
+ * @param data the element
+ * @return if the element was added
+ */
+bool __blocking_q_add(blocking_q *q, task_ptr data) { // NOLINT(bugprone-reserved-identifier)
+
+    bool added;
+
+    if (blocking_q_is_closed(q)) return false;
+
+    switch (q->kind) {
+        case BLOCKING_Q_RING:
+            added = __blocking_q_ring_add(q, data);
+            break;
+        case BLOCKING_Q_MPMC:
+            added = __blocking_q_mpmc_add(q, data);
+            break;
+        case BLOCKING_Q_SPSC:
+            added = __blocking_q_spsc_add(q, data);
+            break;
+        case BLOCKING_Q_HEAP:
+            added = __blocking_q_heap_add_many(q, &data, 1) == 1;
+            break;
+        default:
+            added = __blocking_q_list_add(q, data);
+            break;
+    }
+
+    if (added) __blocking_q_wake_consumers(q, 1);
+
+    return added;
+}
+
+/**
+ * Internal function to blocking_q. Adds as many elements as possible
+ * whatever the kind of the queue, then wakes consumers once for all
+ * of them. Does not block.
+ * @param q the queue
+ * @param data the elements
+ * @param n the amount of elements
+ * @return the amount of elements added
+ */
+size_t __blocking_q_add_many(blocking_q *q, task_ptr *data, size_t n) { // NOLINT(bugprone-reserved-identifier)
+
+    size_t added = 0;
+
+    if (blocking_q_is_closed(q)) return 0;
+
+    switch (q->kind) {
+        case BLOCKING_Q_RING:
+            added = __blocking_q_ring_add_many(q, data, n);
+            break;
+        case BLOCKING_Q_MPMC:
+            // cells are claimed one by one, only the wakeup is batched
+            while (added < n && __blocking_q_mpmc_add(q, data[added]))
+                added++;
+            break;
+        case BLOCKING_Q_SPSC:
+            added = __blocking_q_spsc_add_many(q, data, n);
+            break;
+        case BLOCKING_Q_HEAP:
+            added = __blocking_q_heap_add_many(q, data, n);
+            break;
+        default:
+            added = __blocking_q_list_add_many(q, data, n);
+            break;
+    }
+
+    __blocking_q_wake_consumers(q, added);
+
+    return added;
+}
+
+/**
+ * Internal function to blocking_q. Takes the first element whatever
+ * the kind of the queue and wakes a producer if one is parked. Does
+ * not block.
+ * @param q the queue
+ * @param data where to store the element
+ * @return if an element was taken
+ */
+bool __blocking_q_take(blocking_q *q, task_ptr *data) { // NOLINT(bugprone-reserved-identifier)
+
+    bool taken;
+
+    if (atomic_load(&q->state) == BLOCKING_Q_CLOSED) return false;
+
+    switch (q->kind) {
+        case BLOCKING_Q_RING:
+            taken = __blocking_q_ring_take(q, data);
+            break;
+        case BLOCKING_Q_MPMC:
+            taken = __blocking_q_mpmc_take(q, data);
+            break;
+        case BLOCKING_Q_SPSC:
+            taken = __blocking_q_spsc_take(q, data);
+            break;
+        case BLOCKING_Q_HEAP:
+            taken = __blocking_q_heap_take_many(q, data, 1) == 1;
+            break;
+        default:
+            taken = __blocking_q_list_take(q, data);
+            break;
+    }
+
+    if (taken) __blocking_q_wake_producers(q, 1);
+
+    return taken;
+}
+
+/**
+ * Internal function to blocking_q. Takes up to `n` elements whatever
+ * the kind of the queue, then wakes producers once for all of them.
+ * Does not block.
+ * @param q the queue
+ * @param data where to store the elements
+ * @param n the maximum amount of elements to take
+ * @return the amount of elements taken
+ */
+size_t __blocking_q_take_many(blocking_q *q, task_ptr *data, size_t n) { // NOLINT(bugprone-reserved-identifier)
+
+    size_t taken = 0;
+
+    if (atomic_load(&q->state) == BLOCKING_Q_CLOSED) return 0;
+
+    switch (q->kind) {
+        case BLOCKING_Q_RING:
+            taken = __blocking_q_ring_take_many(q, data, n);
+            break;
+        case BLOCKING_Q_MPMC:
+            // cells are freed one by one, only the wakeup is batched
+            while (taken < n && __blocking_q_mpmc_take(q, data + taken))
+                taken++;
+            break;
+        case BLOCKING_Q_SPSC:
+            taken = __blocking_q_spsc_take_many(q, data, n);
+            break;
+        case BLOCKING_Q_HEAP:
+            taken = __blocking_q_heap_take_many(q, data, n);
+            break;
+        default:
+            taken = __blocking_q_list_take_many(q, data, n);
+            break;
+    }
+
+    __blocking_q_wake_producers(q, taken);
+
+    return taken;
+}
+
+/**
+ * Internal function to blocking_q. Parks the current thread until the
+ * queue holds at least `min` elements or the deadline passes. It may
+ * return early, callers must check again.
+ * @param q the queue
+ * @param min the amount of elements to wait for
+ * @param deadline the CLOCK_MONOTONIC time when to give up, NULL to
+ * wait as long as needed
+ * @return false if the deadline passed
+ */
+bool __blocking_q_wait_elements(blocking_q *q, size_t min, const struct timespec *deadline) { // NOLINT(bugprone-reserved-identifier)
+
+    bool in_time = true;
+
+#ifdef __linux__
+    // any wakeup from now on changes the word and the futex won't sleep
+    uint32_t seen = atomic_load(&q->elements_seq);
+    atomic_fetch_add(&q->waiters, PARKED);
+
+    if (blocking_q_size(q) < min && !blocking_q_is_closed(q))
+        in_time = __blocking_q_futex_wait(&q->elements_seq, seen, deadline);
+
+    __blocking_q_futex_leave(&q->waiters);
+#else
+    pthread_mutex_lock(&q->park_lock);
+    atomic_fetch_add(&q->waiters, PARKED);
+
+    if (blocking_q_size(q) < min && !blocking_q_is_closed(q)) {
+        if (deadline == NULL)
+            pthread_cond_wait(&q->cond, &q->park_lock);
+        else
+            in_time = pthread_cond_timedwait(&q->cond, &q->park_lock, deadline) == 0;
+    }
+
+    atomic_fetch_sub(&q->waiters, PARKED);
+    pthread_mutex_unlock(&q->park_lock);
+#endif
 
-    q->first = first->next;
-    q->sz = q->sz - 1;
+    return in_time;
+}
+
+/**
+ * Internal function to blocking_q. Spins, then yields, while waiting
+ * for the queue to hold at least `min` elements, so that a short gap
+ * between two elements does not cost a sleep and a wakeup.
+ * The spin budget follows the recent waits of the queue: it grows to
+ * twice a wait that ended while spinning and halves whenever
+ * spinning was not enough.
+ * @param q the queue
+ * @param min the amount of elements to wait for
+ * @return if the elements are there or the queue was closed, false
+ * if the caller should park
+ */
+bool __blocking_q_spin_elements(blocking_q *q, size_t min) { // NOLINT(bugprone-reserved-identifier)
+
+    if (q->spin_max == 0) return false;
+
+    size_t budget = atomic_load_explicit(&q->spin_budget, memory_order_relaxed);
+
+    for (size_t i = 0; i < budget; ++i) {
+        if (blocking_q_size(q) >= min || blocking_q_is_closed(q)) {
+            size_t next = 2 * i;
+            if (next < SPIN_MIN) next = SPIN_MIN;
+            if (next > q->spin_max) next = q->spin_max;
+            if (next > budget)
+                atomic_store_explicit(&q->spin_budget, next, memory_order_relaxed);
+            return true;
+        }
+
+        CPU_RELAX();
+    }
+
+    for (int i = 0; i < SPIN_YIELDS; ++i) {
+        sched_yield();
+
+        if (blocking_q_size(q) >= min || blocking_q_is_closed(q)) return true;
+    }
+
+    // the wait was longer than the budget, spin less next time
+    budget /= 2;
+    if (budget < SPIN_MIN) budget = SPIN_MIN;
+    atomic_store_explicit(&q->spin_budget, budget, memory_order_relaxed);
+
+    return false;
+}
+
+/**
+ * Internal function to blocking_q. Parks the current thread until a
+ * bounded queue has room for an element. It may return early,
+ * callers must check again.
+ * @param q the queue
+ */
+void __blocking_q_wait_room(blocking_q *q) { // NOLINT(bugprone-reserved-identifier)
+
+#ifdef __linux__
+    uint32_t seen = atomic_load(&q->room_seq);
+    atomic_fetch_add(&q->put_waiters, PARKED);
+
+    if (blocking_q_size(q) >= q->capacity && !blocking_q_is_closed(q))
+        __blocking_q_futex_wait(&q->room_seq, seen, NULL);
+
+    __blocking_q_futex_leave(&q->put_waiters);
+#else
+    pthread_mutex_lock(&q->park_lock);
+    atomic_fetch_add(&q->put_waiters, PARKED);
 
-    return data;
+    if (blocking_q_size(q) >= q->capacity && !blocking_q_is_closed(q))
+        pthread_cond_wait(&q->not_full, &q->park_lock);
+
+    atomic_fetch_sub(&q->put_waiters, PARKED);
+    pthread_mutex_unlock(&q->park_lock);
+#endif
 }
 
 /**
- * Create a blocking queue. Initializes the synchronisation primitives
- * and
+ * Create an unbounded blocking queue.
  * @param q the queue
  * @return if init was successful.
  */
 bool blocking_q_init(blocking_q *q) {
+    return blocking_q_init_with(q, BLOCKING_Q_LIST, 0);
+}
+
+/**
+ * Create a blocking queue of the given kind. Initializes the
+ * synchronisation primitives and the storage: the dummy node
+ * shared by the head and the tail for a list, the whole array
+ * for a ring, a lock-free queue, a single-producer ring or a heap.
+ * @param q the queue
+ * @param kind the storage backing the queue
+ * @param capacity the maximum amount of elements of a bounded queue,
+ * rounded up to a power of two. Ignored for a list.
+ * @return if init was successful.
+ */
+bool blocking_q_init_with(blocking_q *q, blocking_q_kind kind, size_t capacity) {
+
+    q->kind = kind;
+    q->capacity = 0;
+    atomic_init(&q->state, BLOCKING_Q_OPEN);
+    atomic_init(&q->sz, 0);
 
-    // init empty queue
-    q->sz = 0;
     q->first = NULL;
+    q->last = NULL;
+    q->ring = NULL;
+    q->head = 0;
+    q->tail = 0;
+    q->cells = NULL;
+    q->heap = NULL;
+    q->key = NULL;
+    q->heap_seq = 0;
+    atomic_init(&q->enqueue_pos, 0);
+    atomic_init(&q->dequeue_pos, 0);
+    atomic_init(&q->spsc_tail, 0);
+    atomic_init(&q->spsc_head, 0);
+    q->cached_head = 0;
+    q->cached_tail = 0;
 
-    int err;
+    q->put_cache = NULL;
+    q->take_cache = NULL;
+    q->take_cache_last = NULL;
+    q->take_cached = 0;
+    q->free_nodes = NULL;
+    q->slabs = NULL;
 
-    // default mutex init
-    err = pthread_mutex_init(&q->lock, NULL);
-    if (err != 0)
-        printf("ERROR");
+    // pure condvar waits until blocking_q_set_spin
+    q->spin_max = 0;
+    atomic_init(&q->spin_budget, 0);
 
-    // default cond init
-    err = pthread_cond_init(&q->cond, NULL);
-    if (err != 0)
-        printf("ERROR");
+    atomic_init(&q->waiters, 0);
+    atomic_init(&q->put_waiters, 0);
 
+    if (kind != BLOCKING_Q_LIST) {
+        if (capacity == 0) return false;
 
-    // lock the mutex since the queue is initially empty
-    pthread_mutex_lock(&q->lock);
+        q->capacity = 1;
+        while (q->capacity < capacity) q->capacity <<= 1;
+    }
+
+    if (kind == BLOCKING_Q_RING || kind == BLOCKING_Q_SPSC) {
+        q->ring = malloc(sizeof(task_ptr) * q->capacity);
+        if (q->ring == NULL) return false;
+    } else if (kind == BLOCKING_Q_MPMC) {
+        q->cells = malloc(sizeof(blocking_q_cell) * q->capacity);
+        if (q->cells == NULL) return false;
+
+        // cell i is free for the producer reaching position i
+        for (size_t i = 0; i < q->capacity; ++i)
+            atomic_init(&q->cells[i].seq, i);
+    } else if (kind == BLOCKING_Q_HEAP) {
+        q->heap = malloc(sizeof(blocking_q_heap_entry) * q->capacity);
+        if (q->heap == NULL) return false;
+    } else {
+        // init empty queue, head and tail both point to the dummy,
+        // the rest of the first slab is ready for producers
+        blocking_q_node *dummy = __blocking_q_slab_new(q);
+        if (dummy == NULL) return false;
+
+        q->put_cache = dummy->next;
+        dummy->data = NULL;
+        dummy->next = NULL;
+
+        q->first = dummy;
+        q->last = dummy;
+    }
+
+    // default mutex init, one for the consumers and one for the producers
+    if (pthread_mutex_init(&q->lock, NULL) != 0)
+        goto err_lock;
+
+    if (pthread_mutex_init(&q->tail_lock, NULL) != 0)
+        goto err_tail_lock;
+
+    if (pthread_mutex_init(&q->pool_lock, NULL) != 0)
+        goto err_pool_lock;
+
+#ifdef __linux__
+    // futexes need no init, only their words
+    atomic_init(&q->elements_seq, 0);
+    atomic_init(&q->room_seq, 0);
+
+    return true;
+#else
+    if (pthread_mutex_init(&q->park_lock, NULL) != 0)
+        goto err_park_lock;
+
+    // timed waits are measured on the monotonic clock
+    pthread_condattr_t cond_attr;
+    if (pthread_condattr_init(&cond_attr) != 0)
+        goto err_cond_attr;
+
+    if (pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC) != 0)
+        goto err_cond;
+
+    if (pthread_cond_init(&q->cond, &cond_attr) != 0)
+        goto err_cond;
+
+    if (pthread_cond_init(&q->not_full, &cond_attr) != 0)
+        goto err_not_full;
 
+    pthread_condattr_destroy(&cond_attr);
+
+    return true;
+
+    err_not_full:
+    pthread_cond_destroy(&q->cond);
+    err_cond:
+    pthread_condattr_destroy(&cond_attr);
+    err_cond_attr:
+    pthread_mutex_destroy(&q->park_lock);
+    err_park_lock:
+#endif
+    pthread_mutex_destroy(&q->pool_lock);
+    err_pool_lock:
+    pthread_mutex_destroy(&q->tail_lock);
+    err_tail_lock:
+    pthread_mutex_destroy(&q->lock);
+    err_lock:
+    __blocking_q_slabs_free(q);
+    free(q->ring);
+    free(q->cells);
+    free(q->heap);
     return false;
 }
 
@@ -73,73 +1165,250 @@ bool blocking_q_init(blocking_q *q) {
  */
 void blocking_q_destroy(blocking_q *q) {
 
-    blocking_q_node *curr = q->first;
-    blocking_q_node *next;
+    // free queue, every node lives in a slab
+    __blocking_q_slabs_free(q);
 
-    // free queue
-    while (curr != NULL) {
-        next = curr->next;
-        free(curr);
-        curr = next;
-    }
+    free(q->ring);
+    free(q->cells);
+    free(q->heap);
 
     // free sync. primitives
     pthread_mutex_destroy(&q->lock);
+    pthread_mutex_destroy(&q->tail_lock);
+    pthread_mutex_destroy(&q->pool_lock);
+#ifndef __linux__
+    pthread_mutex_destroy(&q->park_lock);
     pthread_cond_destroy(&q->cond);
+    pthread_cond_destroy(&q->not_full);
+#endif
     return;
 }
 
+/**
+ * Internal function to blocking_q. CPUs the calling thread may run on,
+ * fewer than the online ones under taskset or a cpuset.
+ * @return the amount of CPUs, at least 1
+ */
+int __blocking_q_cpus(void) { // NOLINT(bugprone-reserved-identifier)
+#ifdef __linux__
+    cpu_set_t cpus;
+    if (0 == sched_getaffinity(0, sizeof(cpu_set_t), &cpus) && CPU_COUNT(&cpus) > 0)
+        return CPU_COUNT(&cpus);
+#endif
+
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    return online > 0 ? (int) online : 1;
+}
+
+/**
+ * Let consumers spin and yield before they park on an empty queue.
+ * How long they spin adapts to the recent waits of the queue, up to
+ * `spin_max` spins. Should be set before the queue is shared.
+ * Ignored when the calling thread may only run on a single CPU, where
+ * the producer cannot run while the consumer spins.
+ * @param q the queue
+ * @param spin_max the maximum amount of spins, 0 to always park
+ */
+void blocking_q_set_spin(blocking_q *q, size_t spin_max) {
+
+    if (__blocking_q_cpus() <= 1) spin_max = 0;
+
+    q->spin_max = spin_max;
+    atomic_store(&q->spin_budget, spin_max < SPIN_MIN ? spin_max : SPIN_MIN);
+}
+
+/**
+ * Set how a BLOCKING_Q_HEAP queue orders its tasks. Should be set
+ * before the queue is shared.
+ * @param q the queue
+ * @param key computes the priority of a task, the lowest comes out
+ * first. NULL keeps the order in which tasks were put.
+ */
+void blocking_q_set_key(blocking_q *q, blocking_q_key key) {
+    q->key = key;
+}
+
+/**
+ * Amount of elements in the queue. This is only a snapshot when
+ * other threads use the queue.
+ * @param q the queue
+ * @return the amount of elements
+ */
+size_t blocking_q_size(blocking_q *q) {
+
+    if (q->kind == BLOCKING_Q_SPSC) {
+        // the head never passes a tail read after it
+        size_t head = atomic_load(&q->spsc_head);
+        return atomic_load(&q->spsc_tail) - head;
+    }
+
+    if (q->kind != BLOCKING_Q_MPMC) return atomic_load(&q->sz);
+
+    // positions are read one after the other, the difference
+    // can be briefly out of range while others move them
+    size_t dequeued = atomic_load(&q->dequeue_pos);
+    size_t enqueued = atomic_load(&q->enqueue_pos);
+
+    if (enqueued < dequeued) return 0;
+    if (enqueued - dequeued > q->capacity) return q->capacity;
+    return enqueued - dequeued;
+}
+
 
 /**
  * Put a task in the blocking queue. This task can fail if no
- * memory is available to allocate a new entry in the queue
+ * memory is available to allocate a new entry in a list, or if
+ * the queue was closed.
+ * A full bounded queue blocks the producer until a slot is freed.
  * @param q the queue
  * @param data the data description to put inside the queue
  * @returns if the data was put correctly inside the queue.
  */
 bool blocking_q_put(blocking_q *q, task_ptr data) {
 
-    blocking_q_node *new_node = malloc(sizeof(blocking_q_node));
-    // error with malloc ->
-    if (new_node == NULL) return 0;
+    while (!__blocking_q_add(q, data)) {
+        // error with malloc ->
+        if (q->kind == BLOCKING_Q_LIST || blocking_q_is_closed(q)) return false;
 
-    new_node->data = data;
-    new_node->next = NULL;
+        __blocking_q_wait_room(q);
+    }
+
+    return true;
+}
+
+/**
+ * Put several tasks in the blocking queue, in order. Each task is
+ * added with as few lock holds and wakeups as the kind allows: the
+ * whole batch at once for a list, as much as fits for a bounded
+ * queue, which then blocks the producer until the rest fits.
+ * This task can fail if no memory is available to allocate the
+ * entries of a list, in which case none of the tasks is added, or
+ * if the queue was closed, in which case only the first ones may be
+ * added.
+ * @param q the queue
+ * @param data the tasks to put inside the queue
+ * @param n the amount of tasks
+ * @returns the amount of tasks put inside the queue, the first ones
+ * of `data`, n if all were.
+ */
+size_t blocking_q_put_many(blocking_q *q, task_ptr *data, size_t n) {
+
+    size_t put = 0;
+
+    while (put < n) {
+        size_t added = __blocking_q_add_many(q, data + put, n - put);
+        put += added;
 
-    blocking_q_node *curr = q->first;
-    while (curr->next != NULL) curr = curr->next;
+        if (added == 0) {
+            // error with malloc ->
+            if (q->kind == BLOCKING_Q_LIST || blocking_q_is_closed(q)) return put;
 
-    curr->next = new_node;
-    q->sz = q->sz + 1;
+            __blocking_q_wait_room(q);
+        }
+    }
 
-    if (q->sz == 1) pthread_cond_signal(&q->cond);
+    return put;
+}
 
-    return 1;
+/**
+ * Put a task in the blocking queue without waiting. Same as
+ * blocking_q_put for a list, fails right away on a full bounded queue.
+ * @param q the queue
+ * @param data the data description to put inside the queue
+ * @returns if the data was put correctly inside the queue.
+ */
+bool blocking_q_try_put(blocking_q *q, task_ptr data) {
+    return __blocking_q_add(q, data);
 }
 
 /**
  * Get an element in the blocking queue. If the queue is empty,
  * the current thread is put to sleep until an element is added
- * to the queue.
+ * to the queue or the queue is closed.
  * @param q the blocking queue
- * @return the element
+ * @return the element, NULL once the queue is closed and drained
  */
 task_ptr blocking_q_get(blocking_q *q) {
+
+    task_ptr element;
+
     // using `while` instead of `if` to avoid some problems
-    while (q->sz == 0) {
-        /* Wait for elements
-        -> - blocks the thread until the specified condition is signalled.
-           - mutex should be locked and then automatically release while wait
-           - must be unlocked once finished
-        */
-        pthread_cond_wait(&q->cond, &q->lock);
+    while (!__blocking_q_take(q, &element)) {
+        if (blocking_q_is_closed(q)) return NULL;
+
+        if (!__blocking_q_spin_elements(q, 1))
+            __blocking_q_wait_elements(q, 1, NULL);
     }
-    task_ptr element = __blocking_q_take(q);
 
-    if (q->sz == 0) pthread_mutex_lock(&q->lock);
+    return element;
+
+}
+
+/**
+ * Get an element in the blocking queue without waiting.
+ * @param q the blocking queue
+ * @return the element, NULL if the queue was empty
+ */
+task_ptr blocking_q_try_get(blocking_q *q) {
+
+    task_ptr element;
+
+    if (!__blocking_q_take(q, &element)) return NULL;
 
     return element;
+}
+
+/**
+ * Internal function to blocking_q. Absolute CLOCK_MONOTONIC time some
+ * nanoseconds from now, for timed waits.
+ * @param deadline where to store the time
+ * @param ns the nanoseconds from now
+ */
+void __blocking_q_deadline(struct timespec *deadline, long ns) { // NOLINT(bugprone-reserved-identifier)
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += ns / 1000000000L;
+    deadline->tv_nsec += ns % 1000000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+/**
+ * Get an element in the blocking queue, waiting at most `ns`
+ * nanoseconds for one to be added if the queue is empty. Spins first
+ * like blocking_q_get, the spin counts in the `ns`.
+ * @param q the blocking queue
+ * @param ns the maximum time to wait, in nanoseconds
+ * @return the element, NULL if none was added in time or the queue
+ * is closed and drained
+ */
+task_ptr blocking_q_get_timeout(blocking_q *q, long ns) {
+
+    task_ptr element;
+
+    if (__blocking_q_take(q, &element)) return element;
+
+    struct timespec deadline;
+    __blocking_q_deadline(&deadline, ns);
 
+    bool spun = false;
+
+    while (!__blocking_q_take(q, &element)) {
+        if (blocking_q_is_closed(q)) return NULL;
+
+        // the spin is far shorter than any sensible timeout
+        if (!spun) {
+            spun = true;
+            if (__blocking_q_spin_elements(q, 1)) continue;
+        }
+
+        // one last try once the deadline passed
+        if (!__blocking_q_wait_elements(q, 1, &deadline))
+            return __blocking_q_take(q, &element) ? element : NULL;
+    }
+
+    return element;
 }
 
 /**
@@ -152,20 +1421,17 @@ task_ptr blocking_q_get(blocking_q *q) {
  */
 size_t blocking_q_drain(blocking_q *q, task_ptr *data, size_t sz) {
 
-    if (q->sz == 0) return 0;
-
-    int counter = 0;
-    data = malloc(sizeof(task_ptr) * sz);
-
-    while (q->sz > 0)
-        data[counter++] = __blocking_q_take(q);
+    if (sz == 0 || blocking_q_size(q) == 0) return 0;
 
-    pthread_mutex_lock(&q->lock);
+    return __blocking_q_take_many(q, data, sz);
 }
 
 /**
  * Drain at least min elements in the buffer. This function
- * might block if there are not enough elements to drain.
+ * might block if there are not enough elements to drain, unless
+ * the queue is closed, then it returns whatever it could drain.
+ * Whatever is available is taken before the thread parks, and
+ * it only wakes up to take more once elements were added.
  * @param q the queue
  * @param data the pointer where to store the data
  * @param sz the maximum area available in the buffer
@@ -174,34 +1440,168 @@ size_t blocking_q_drain(blocking_q *q, task_ptr *data, size_t sz) {
  */
 size_t blocking_q_drain_at_least(blocking_q *q, task_ptr *data, size_t sz, size_t min) {
 
-    int counter = 0;
+    if (min > sz) min = sz;
+
+    size_t counter = __blocking_q_take_many(q, data, sz);
 
-    loop:
-    while(q->sz > 0) {
-        data[counter++] = __blocking_q_take(q);
+    while (counter < min && !blocking_q_is_closed(q)) {
+        if (!__blocking_q_spin_elements(q, min - counter))
+            __blocking_q_wait_elements(q, min - counter, NULL);
+        counter += __blocking_q_take_many(q, data + counter, sz - counter);
     }
-    pthread_mutex_lock(&q->lock);
 
-    if (min > counter) {
-        while (q->sz < (min - counter)) pthread_cond_wait(&q->cond, &q->lock);
-        goto loop;
+    return counter;
+}
+
+/**
+ * Drain at least min elements in the buffer, waiting at most `ns`
+ * nanoseconds for them. Like blocking_q_drain_at_least, it returns
+ * whatever it could drain once the queue is closed, or once the time
+ * is up.
+ * @param q the queue
+ * @param data the pointer where to store the data
+ * @param sz the maximum area available in the buffer
+ * @param min the minimum amounts of elements to drain (must be less than sz)
+ * @param ns the maximum time to wait, in nanoseconds
+ * @return the number of elements written
+ */
+size_t blocking_q_drain_at_least_timeout(blocking_q *q, task_ptr *data, size_t sz, size_t min, long ns) {
+
+    if (min > sz) min = sz;
+
+    size_t counter = __blocking_q_take_many(q, data, sz);
+    if (counter >= min || blocking_q_is_closed(q)) return counter;
+
+    struct timespec deadline;
+    __blocking_q_deadline(&deadline, ns);
+
+    bool spun = false;
+
+    while (counter < min && !blocking_q_is_closed(q)) {
+        bool in_time = true;
+
+        // spin once, the wait then lasts until the deadline
+        if (spun || !__blocking_q_spin_elements(q, min - counter))
+            in_time = __blocking_q_wait_elements(q, min - counter, &deadline);
+
+        spun = true;
+        counter += __blocking_q_take_many(q, data + counter, sz - counter);
+
+        if (!in_time) break;
     }
 
     return counter;
 }
 
 /**
- * Check the first element in the queue. This will allocate storage for a copy
- * of the character. If the allocation fails, this function returns false.
+ * Check the first element in the queue without removing it.
+ * If the queue is empty, this function returns false. On a
+ * lock-free queue the element may be taken as soon as it is read.
+ * Any thread may peek, except on a BLOCKING_Q_SPSC queue where only
+ * the consumer may.
  * @param q the queue
- * @param c pointer to a pointer where an allocated char will be stored
- * @return if there is an element allocated in the pointer
+ * @param c pointer where the first task will be stored
+ * @return if there is an element stored in the pointer
  */
 bool blocking_q_peek(blocking_q *q, task **c) {
 
-    if (q->sz == 0) return false;
-    c = malloc(sizeof(task_ptr));
+    if (q->kind == BLOCKING_Q_MPMC) {
+        for (;;) {
+            size_t pos = atomic_load(&q->dequeue_pos);
+            blocking_q_cell *cell = q->cells + (pos & (q->capacity - 1));
+            size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+            intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+
+            // the producer of this cell did not publish yet
+            if (diff < 0) return false;
+
+            // a consumer took it since `pos` was read, look at the next one
+            if (diff > 0) continue;
+
+            task_ptr data = atomic_load_explicit(&cell->data, memory_order_relaxed);
 
-    c = &(q->first->data);
+            // still full: no consumer took it and no producer refilled it
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&cell->seq, memory_order_relaxed) == pos + 1) {
+                *c = data;
+                return true;
+            }
+        }
+    }
+
+    if (q->kind == BLOCKING_Q_SPSC) {
+        size_t head = atomic_load(&q->spsc_head);
+
+        if (atomic_load(&q->spsc_tail) == head) return false;
+
+        *c = q->ring[head & (q->capacity - 1)];
+        return true;
+    }
+
+    pthread_mutex_lock(&q->lock);
+
+    bool found = atomic_load(&q->sz) > 0;
+    if (found && q->kind == BLOCKING_Q_RING)
+        *c = q->ring[q->head & (q->capacity - 1)];
+    else if (found && q->kind == BLOCKING_Q_HEAP)
+        *c = q->heap[0].data;
+    else if (found)
+        *c = q->first->next->data;
+
+    pthread_mutex_unlock(&q->lock);
+
+    return found;
+}
+
+/**
+ * Internal function to blocking_q. Moves the queue to a closed state
+ * and wakes every parked thread so that it notices.
+ * @param q the queue
+ * @param state BLOCKING_Q_DRAINING or BLOCKING_Q_CLOSED
+ */
+void __blocking_q_set_state(blocking_q *q, int state) { // NOLINT(bugprone-reserved-identifier)
+
+    // a queue never reopens nor goes back to draining
+    int curr = atomic_load(&q->state);
+    while (curr < state && !atomic_compare_exchange_weak(&q->state, &curr, state));
 
-}
\ No newline at end of file
+#ifdef __linux__
+    // waiters are counted before checking the state, wake them all
+    __blocking_q_futex_wake(&q->elements_seq, &q->waiters, SIZE_MAX);
+    __blocking_q_futex_wake(&q->room_seq, &q->put_waiters, SIZE_MAX);
+#else
+    // waiters check the state under `park_lock` before sleeping
+    pthread_mutex_lock(&q->park_lock);
+    pthread_cond_broadcast(&q->cond);
+    pthread_cond_broadcast(&q->not_full);
+    pthread_mutex_unlock(&q->park_lock);
+#endif
+}
+
+/**
+ * Close the queue for producers. Every put fails from now on,
+ * consumers still get the elements left and then NULL instead of
+ * blocking. A put racing with the close may still go through.
+ * @param q the queue
+ */
+void blocking_q_close(blocking_q *q) {
+    __blocking_q_set_state(q, BLOCKING_Q_DRAINING);
+}
+
+/**
+ * Close the queue for producers and consumers. Every put fails and
+ * every get returns NULL from now on, even if elements are left.
+ * @param q the queue
+ */
+void blocking_q_close_now(blocking_q *q) {
+    __blocking_q_set_state(q, BLOCKING_Q_CLOSED);
+}
+
+/**
+ * Check if the queue was closed, draining or not.
+ * @param q the queue
+ * @return if the queue is closed
+ */
+bool blocking_q_is_closed(blocking_q *q) {
+    return atomic_load(&q->state) != BLOCKING_Q_OPEN;
+}
@@ -0,0 +1,238 @@
+#ifndef BLOCKING_Q_H
+#define BLOCKING_Q_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/**
+ * A unit of work. The type is one of the task letters of the
+ * argument string. The times follow the task through the scheduler:
+ * when it entered the scheduler queue, when the scheduler handed it to
+ * a processor, and when it ran. `processor` is the ID of the processor
+ * it was handed to, which is not always the one running it, and
+ * `cost` the work the scheduler expected from it. A task may have to
+ * end by its `deadline`, 0 if it has none.
+ */
+typedef struct task {
+    char type;
+    int processor;
+    long cost;
+    long deadline;
+    long enqueued;
+    long dispatched;
+    long start;
+    long end;
+} task;
+
+typedef task *task_ptr;
+
+typedef struct blocking_q_node {
+    task_ptr data;
+    struct blocking_q_node *next;
+} blocking_q_node;
+
+#define BLOCKING_Q_SLAB_NODES 64
+
+/**
+ * Block of nodes allocated at once by a BLOCKING_Q_LIST queue. Slabs
+ * are only released when the queue is destroyed.
+ */
+typedef struct blocking_q_slab {
+    struct blocking_q_slab *next;
+    blocking_q_node nodes[BLOCKING_Q_SLAB_NODES];
+} blocking_q_slab;
+
+/**
+ * Storage backing a blocking queue, chosen when the queue is created.
+ */
+typedef enum blocking_q_kind {
+    BLOCKING_Q_LIST,
+    BLOCKING_Q_RING,
+    BLOCKING_Q_MPMC,
+    BLOCKING_Q_SPSC,
+    BLOCKING_Q_HEAP,
+} blocking_q_kind;
+
+#define BLOCKING_Q_CACHE_LINE 64
+
+/**
+ * Priority of a task in a BLOCKING_Q_HEAP queue, the lowest comes
+ * out first. Computed once, when the task is put.
+ */
+typedef long (*blocking_q_key)(task_ptr data);
+
+/**
+ * Slot of a BLOCKING_Q_HEAP queue. `seq` keeps tasks of the same key
+ * in the order they were put.
+ */
+typedef struct blocking_q_heap_entry {
+    long key;
+    size_t seq;
+    task_ptr data;
+} blocking_q_heap_entry;
+
+/**
+ * Whether a queue still accepts elements. A draining queue hands out
+ * the elements it holds and then reports that it is empty for good,
+ * a closed queue stops handing them out right away.
+ */
+typedef enum blocking_q_state {
+    BLOCKING_Q_OPEN,
+    BLOCKING_Q_DRAINING,
+    BLOCKING_Q_CLOSED,
+} blocking_q_state;
+
+/**
+ * Slot of a BLOCKING_Q_MPMC queue. The sequence number tells
+ * producers and consumers whose turn it is to use the slot. The data
+ * is atomic so that blocking_q_peek may read it while the slot is
+ * taken and filled again, the sequence number orders it otherwise.
+ */
+typedef struct blocking_q_cell {
+    _Atomic size_t seq;
+    _Atomic(task_ptr) data;
+} blocking_q_cell;
+
+/**
+ * FIFO blocking queue.
+ *
+ * BLOCKING_Q_LIST is unbounded. Two-lock design: producers only
+ * take `tail_lock` to append after `last`, consumers only take
+ * `lock` to unlink after `first`, which is always a dummy node.
+ * Nodes come from a pool of slabs: each side keeps a cache of nodes
+ * under the lock it already holds, and full batches of unlinked
+ * nodes go back to producers through `free_nodes`.
+ *
+ * BLOCKING_Q_RING is bounded to a power of two `capacity` and never
+ * allocates after init. Everything is guarded by `lock`.
+ *
+ * BLOCKING_Q_MPMC is bounded like a ring but lock-free: producers
+ * and consumers claim `cells` by advancing `enqueue_pos` and
+ * `dequeue_pos` with a CAS.
+ *
+ * BLOCKING_Q_SPSC is a ring for exactly one producer thread and one
+ * consumer thread. Each side owns its index on its own cache line
+ * and keeps a cached copy of the other side's index, so the shared
+ * lines are only read again when the ring looks full or empty.
+ *
+ * BLOCKING_Q_HEAP is bounded like a ring but hands out the task of
+ * lowest `key` first, FIFO among equal keys. It is a binary heap
+ * guarded by `lock`. Without a key it behaves like a ring.
+ *
+ * Whatever the kind, threads only park once they observed the queue
+ * empty or full, and the other side only makes a wakeup when
+ * `waiters` or `put_waiters` says someone is parked, waking as many
+ * as there are new elements or free slots. Both count the parked
+ * threads in their high 32 bits. On Linux they park with a futex on
+ * the `elements_seq` or `room_seq` sequence counter, and the low bits
+ * count the wakeups their threads did not take yet, elsewhere they
+ * park on `park_lock` with `cond` or `not_full`.
+ * Consumers may first spin and yield for a while, see
+ * blocking_q_set_spin.
+ */
+typedef struct blocking_q {
+    blocking_q_kind kind;
+    size_t capacity;
+    _Atomic int state;
+
+    // Consumer side: BLOCKING_Q_LIST, BLOCKING_Q_RING and BLOCKING_Q_HEAP
+    // take `lock`, the list pops at `first`. Kept off the lines written
+    // by the producers of a list and by `sz`, which both sides update.
+    _Alignas(BLOCKING_Q_CACHE_LINE) pthread_mutex_t lock;
+    blocking_q_node *first;
+    blocking_q_node *take_cache;    // under lock
+    blocking_q_node *take_cache_last;
+    size_t take_cached;
+
+    _Alignas(BLOCKING_Q_CACHE_LINE) _Atomic size_t sz;
+
+    // Producer side of BLOCKING_Q_LIST
+    _Alignas(BLOCKING_Q_CACHE_LINE) pthread_mutex_t tail_lock;
+    blocking_q_node *last;
+    blocking_q_node *put_cache;     // under tail_lock
+
+    // BLOCKING_Q_LIST node pool
+    _Alignas(BLOCKING_Q_CACHE_LINE) blocking_q_node *free_nodes;    // under pool_lock
+    blocking_q_slab *slabs;
+    pthread_mutex_t pool_lock;
+
+    // BLOCKING_Q_RING
+    task_ptr *ring;
+    size_t head;
+    size_t tail;
+
+    // BLOCKING_Q_MPMC
+    blocking_q_cell *cells;
+    _Atomic size_t enqueue_pos;
+    _Atomic size_t dequeue_pos;
+
+    // BLOCKING_Q_HEAP
+    blocking_q_heap_entry *heap;
+    blocking_q_key key;
+    size_t heap_seq;
+
+    // BLOCKING_Q_SPSC, uses `ring` as storage
+    _Alignas(BLOCKING_Q_CACHE_LINE) _Atomic size_t spsc_tail;
+    size_t cached_head;
+    _Alignas(BLOCKING_Q_CACHE_LINE) _Atomic size_t spsc_head;
+    size_t cached_tail;
+
+    // spinning before parking, `spin_budget` adapts up to `spin_max`
+    size_t spin_max;
+    _Atomic size_t spin_budget;
+
+    // parking
+    _Alignas(BLOCKING_Q_CACHE_LINE) _Atomic uint64_t waiters;
+    _Atomic uint64_t put_waiters;
+#ifdef __linux__
+    _Atomic uint32_t elements_seq;
+    _Atomic uint32_t room_seq;
+#else
+    pthread_mutex_t park_lock;
+    pthread_cond_t cond;
+    pthread_cond_t not_full;
+#endif
+} blocking_q;
+
+bool blocking_q_init(blocking_q *q);
+
+bool blocking_q_init_with(blocking_q *q, blocking_q_kind kind, size_t capacity);
+
+void blocking_q_destroy(blocking_q *q);
+
+void blocking_q_set_spin(blocking_q *q, size_t spin_max);
+
+void blocking_q_set_key(blocking_q *q, blocking_q_key key);
+
+size_t blocking_q_size(blocking_q *q);
+
+bool blocking_q_put(blocking_q *q, task_ptr data);
+
+size_t blocking_q_put_many(blocking_q *q, task_ptr *data, size_t n);
+
+bool blocking_q_try_put(blocking_q *q, task_ptr data);
+
+task_ptr blocking_q_get(blocking_q *q);
+
+task_ptr blocking_q_try_get(blocking_q *q);
+
+task_ptr blocking_q_get_timeout(blocking_q *q, long ns);
+
+size_t blocking_q_drain(blocking_q *q, task_ptr *data, size_t sz);
+
+size_t blocking_q_drain_at_least(blocking_q *q, task_ptr *data, size_t sz, size_t min);
+
+size_t blocking_q_drain_at_least_timeout(blocking_q *q, task_ptr *data, size_t sz, size_t min, long ns);
+
+bool blocking_q_peek(blocking_q *q, task **c);
+
+void blocking_q_close(blocking_q *q);
+
+void blocking_q_close_now(blocking_q *q);
+
+bool blocking_q_is_closed(blocking_q *q);
+
+#endif //BLOCKING_Q_H
@@ -0,0 +1,92 @@
+#include <stdatomic.h>
+#include "cost_model.h"
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
+
+/**
+ * Internal function to cost_model. Square root by Newton's method, so
+ * that the model does not need libm. Starting above the root, every
+ * step decreases until the root is reached.
+ * @param x the value, not negative
+ * @return the square root
+ */
+double __cost_model_sqrt(double x) { // NOLINT(bugprone-reserved-identifier)
+
+    if (!(x > 0)) return 0;
+
+    double root = x > 1 ? x : 1;
+
+    for (;;) {
+        double next = (root + x / root) / 2;
+        if (next >= root) return root;
+        root = next;
+    }
+}
+
+/**
+ * Create a model without samples.
+ * @param m the model
+ * @param prior the cost until the first sample
+ */
+void cost_model_init(cost_model *m, long prior) {
+    atomic_init(&m->mean, (double) prior);
+    atomic_init(&m->var, 0.0);
+    atomic_init(&m->samples, 0);
+}
+
+/**
+ * Add a measured cost to the model. Any thread may call it.
+ * @param m the model
+ * @param sample the cost
+ */
+void cost_model_record(cost_model *m, long sample) {
+    long n = atomic_fetch_add_explicit(&m->samples, 1, memory_order_relaxed);
+    double x = (double) sample;
+    double mean = atomic_load_explicit(&m->mean, memory_order_relaxed);
+
+    // the first samples make a plain average, the prior is forgotten
+    double alpha = n < COST_MODEL_WARMUP ? 1.0 / (double) (n + 1) : COST_MODEL_ALPHA;
+
+    if (n >= COST_MODEL_WARMUP) {
+        double dev = __cost_model_sqrt(atomic_load_explicit(&m->var, memory_order_relaxed));
+        double min_dev = (mean < 0 ? -mean : mean) / COST_MODEL_MIN_DEV;
+        double bound = COST_MODEL_CLAMP * (dev > min_dev ? dev : min_dev);
+
+        if (x > mean + bound) x = mean + bound;
+        else if (x < mean - bound) x = mean - bound;
+    }
+
+    double next;
+    do {
+        next = mean + alpha * (x - mean);
+    } while (!atomic_compare_exchange_weak_explicit(&m->mean, &mean, next,
+                                                    memory_order_relaxed, memory_order_relaxed));
+
+    // West's incremental update, around the mean seen before the sample
+    double diff = x - mean;
+    double var = atomic_load_explicit(&m->var, memory_order_relaxed);
+
+    do {
+        next = (1 - alpha) * (var + alpha * diff * diff);
+    } while (!atomic_compare_exchange_weak_explicit(&m->var, &var, next,
+                                                    memory_order_relaxed, memory_order_relaxed));
+}
+
+/**
+ * Expected cost.
+ * @param m the model
+ * @return the moving average of the samples, the prior without any
+ */
+long cost_model_mean(cost_model *m) {
+    return (long) atomic_load_explicit(&m->mean, memory_order_relaxed);
+}
+
+/**
+ * Spread of the cost.
+ * @param m the model
+ * @return the standard deviation of the samples
+ */
+long cost_model_stddev(cost_model *m) {
+    return (long) __cost_model_sqrt(atomic_load_explicit(&m->var, memory_order_relaxed));
+}
@@ -0,0 +1,43 @@
+#ifndef COST_MODEL_H
+#define COST_MODEL_H
+
+#include <stdatomic.h>
+#include "blocking_q.h"
+
+// Weight of a new sample in the moving averages, once there are
+// COST_MODEL_WARMUP samples. Before, the mean is the plain average.
+#define COST_MODEL_ALPHA (1.0 / 8)
+#define COST_MODEL_WARMUP 8
+
+// Once warm, a sample counts as at most COST_MODEL_CLAMP standard
+// deviations away from the mean, a deviation of at least
+// 1 / COST_MODEL_MIN_DEV of the mean
+#define COST_MODEL_CLAMP 3.0
+#define COST_MODEL_MIN_DEV 8
+
+/**
+ * Online estimate of the cost of a task type, in nanoseconds: an
+ * exponentially weighted moving average of the measured samples and
+ * of their variance.
+ *
+ * Any thread may record a sample without a lock, mean and variance are
+ * updated each with its own CAS loop. A reader may see the mean of a
+ * sample before its variance. Outliers are clamped before they enter
+ * the averages, a lasting drift still moves them a few deviations at
+ * a time.
+ */
+typedef struct cost_model {
+    _Alignas(BLOCKING_Q_CACHE_LINE) _Atomic double mean;
+    _Atomic double var;
+    _Atomic long samples;
+} cost_model;
+
+void cost_model_init(cost_model *m, long prior);
+
+void cost_model_record(cost_model *m, long sample);
+
+long cost_model_mean(cost_model *m);
+
+long cost_model_stddev(cost_model *m);
+
+#endif //COST_MODEL_H
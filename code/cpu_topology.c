@@ -0,0 +1,187 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <sched.h>
+#include "cpu_topology.h"
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
+
+#define CPU_TOPOLOGY_PATH "/sys/devices/system/cpu/cpu%d/topology/%s"
+
+/**
+ * Where a CPU sits: its socket, its physical core and its rank among
+ * the SMT siblings of that core.
+ */
+typedef struct cpu_topology_cpu {
+    int cpu;
+    int package;
+    int core;
+    int smt_rank;
+} cpu_topology_cpu;
+
+/**
+ * Open a topology file of a CPU
+ * @param cpu the CPU
+ * @param name the name of the file
+ * @return the file, NULL if it does not exist
+ */
+FILE *__cpu_topology_open(int cpu, const char *name) { // NOLINT(bugprone-reserved-identifier)
+    char path[128];
+    snprintf(path, sizeof(path), CPU_TOPOLOGY_PATH, cpu, name);
+    return fopen(path, "r");
+}
+
+/**
+ * Read a number from a topology file of a CPU
+ * @param cpu the CPU
+ * @param name the name of the file
+ * @param fallback the value if the file cannot be read
+ * @return the number
+ */
+int __cpu_topology_read_int(int cpu, const char *name, int fallback) { // NOLINT(bugprone-reserved-identifier)
+    FILE *f = __cpu_topology_open(cpu, name);
+    if (NULL == f) return fallback;
+
+    int value;
+    if (1 != fscanf(f, "%d", &value)) value = fallback;
+
+    fclose(f);
+    return value;
+}
+
+/**
+ * Rank of a CPU among its SMT siblings, read from a list such as
+ * "2,6" or "2-3": the amount of siblings with a lower number.
+ * @param cpu the CPU
+ * @return the rank, 0 if the siblings are unknown
+ */
+int __cpu_topology_smt_rank(int cpu) { // NOLINT(bugprone-reserved-identifier)
+    FILE *f = __cpu_topology_open(cpu, "thread_siblings_list");
+    if (NULL == f) return 0;
+
+    int rank = 0;
+    int first, last;
+
+    while (1 == fscanf(f, "%d", &first)) {
+        last = first;
+
+        int c = fgetc(f);
+        if ('-' == c) {
+            if (1 != fscanf(f, "%d", &last)) break;
+            c = fgetc(f);
+        }
+
+        for (int sibling = first; sibling <= last; ++sibling)
+            if (sibling < cpu) ++rank;
+
+        if (',' != c) break;
+    }
+
+    fclose(f);
+    return rank;
+}
+
+/**
+ * Placement order: socket first, then physical cores before their
+ * SMT siblings.
+ * @param v_a a CPU
+ * @param v_b another CPU
+ * @return the order of both CPUs, for qsort
+ */
+int __cpu_topology_cmp(const void *v_a, const void *v_b) { // NOLINT(bugprone-reserved-identifier)
+    const cpu_topology_cpu *a = v_a;
+    const cpu_topology_cpu *b = v_b;
+
+    if (a->package != b->package) return a->package < b->package ? -1 : 1;
+    if (a->smt_rank != b->smt_rank) return a->smt_rank < b->smt_rank ? -1 : 1;
+    if (a->core != b->core) return a->core < b->core ? -1 : 1;
+    return a->cpu < b->cpu ? -1 : a->cpu > b->cpu;
+}
+
+/**
+ * Read the topology of the CPUs the process may use. This can fail if
+ * the CPUs cannot be listed or there is no memory for them.
+ * @param topo the topology
+ * @return if init was successful.
+ */
+bool cpu_topology_init(cpu_topology *topo) {
+    cpu_set_t allowed;
+
+    if (0 != sched_getaffinity(0, sizeof(cpu_set_t), &allowed)) return false;
+
+    int cpu_c = CPU_COUNT(&allowed);
+    if (cpu_c <= 0) return false;
+
+    cpu_topology_cpu *cpus = malloc(sizeof(cpu_topology_cpu) * cpu_c);
+    if (NULL == cpus) return false;
+
+    int n = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE && n < cpu_c; ++cpu) {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+
+        cpus[n].cpu = cpu;
+        cpus[n].package = __cpu_topology_read_int(cpu, "physical_package_id", 0);
+        cpus[n].core = __cpu_topology_read_int(cpu, "core_id", cpu);
+        cpus[n].smt_rank = __cpu_topology_smt_rank(cpu);
+        ++n;
+    }
+
+    qsort(cpus, n, sizeof(cpu_topology_cpu), __cpu_topology_cmp);
+
+    topo->sched_cpus = malloc(sizeof(int) * n);
+    if (NULL == topo->sched_cpus) goto err_sched;
+
+    topo->processor_cpus = malloc(sizeof(int) * n);
+    if (NULL == topo->processor_cpus) goto err_processor;
+
+    topo->sched_cpu_c = 0;
+    topo->processor_cpu_c = 0;
+
+    // The scheduler keeps the first physical core with its siblings
+    for (int i = 0; i < n; ++i) {
+        if (cpus[i].package == cpus[0].package && cpus[i].core == cpus[0].core)
+            topo->sched_cpus[topo->sched_cpu_c++] = cpus[i].cpu;
+        else
+            topo->processor_cpus[topo->processor_cpu_c++] = cpus[i].cpu;
+    }
+
+    // A single core is shared
+    if (0 == topo->processor_cpu_c) {
+        for (int i = 0; i < topo->sched_cpu_c; ++i)
+            topo->processor_cpus[topo->processor_cpu_c++] = topo->sched_cpus[i];
+    }
+
+    free(cpus);
+    return true;
+
+    err_processor:
+    free(topo->sched_cpus);
+    err_sched:
+    free(cpus);
+    return false;
+}
+
+/**
+ * Destroy a topology
+ * @param topo the topology
+ */
+void cpu_topology_destroy(cpu_topology *topo) {
+    free(topo->sched_cpus);
+    free(topo->processor_cpus);
+}
+
+/**
+ * CPU a processor runs on. Processors share CPUs in the same order
+ * once there are more of them than CPUs.
+ * @param topo the topology
+ * @param i the ID of the processor
+ * @return the CPU
+ */
+int cpu_topology_processor_cpu(const cpu_topology *topo, int i) {
+    return topo->processor_cpus[i % topo->processor_cpu_c];
+}
@@ -0,0 +1,29 @@
+#ifndef CPU_TOPOLOGY_H
+#define CPU_TOPOLOGY_H
+
+#include <stdbool.h>
+
+/**
+ * Placement of the threads on the CPUs the process may use, read from
+ * /sys/devices/system/cpu.
+ *
+ * The scheduler side gets every CPU of the first physical core. The
+ * processors get the other CPUs, ordered so that one socket is filled
+ * before the next, and within a socket every physical core gets a
+ * thread before its SMT siblings do. They share the scheduler's core
+ * only if there is no other one.
+ */
+typedef struct cpu_topology {
+    int *sched_cpus;
+    int sched_cpu_c;
+    int *processor_cpus;
+    int processor_cpu_c;
+} cpu_topology;
+
+bool cpu_topology_init(cpu_topology *topo);
+
+void cpu_topology_destroy(cpu_topology *topo);
+
+int cpu_topology_processor_cpu(const cpu_topology *topo, int i);
+
+#endif //CPU_TOPOLOGY_H
@@ -0,0 +1,353 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include "blocking_q.h"
+#include "delay_q.h"
+#include "monotonic.h"
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
+
+#define SLOT_MASK (DELAY_Q_SLOTS - 1)
+
+// Maximum amount of tasks put at once in the target queue
+#define RELEASE_BATCH 64
+
+/**
+ * Internal function to delay_q. Appends a node to the slot of its due
+ * tick, at the lowest level whose range covers it. A node due further
+ * than the whole wheel goes to the last slot in range and is put back
+ * when that slot expires. The caller must hold `lock`.
+ * @param dq the delay queue
+ * @param node the node
+ */
+void __delay_q_insert(delay_q *dq, delay_q_node *node) { // NOLINT(bugprone-reserved-identifier)
+
+    long due = node->due < dq->current ? dq->current : node->due;
+    long delta = due - dq->current;
+
+    int level = 0;
+    while (level < DELAY_Q_LEVELS - 1 && delta >= 1L << (DELAY_Q_SLOT_BITS * (level + 1)))
+        level++;
+
+    long range = 1L << (DELAY_Q_SLOT_BITS * DELAY_Q_LEVELS);
+    if (delta >= range) due = dq->current + range - 1;
+
+    long slot = (due >> (DELAY_Q_SLOT_BITS * level)) & SLOT_MASK;
+    node->next = NULL;
+
+    if (dq->wheel[level][slot] == NULL) dq->wheel[level][slot] = node;
+    else dq->wheel_last[level][slot]->next = node;
+    dq->wheel_last[level][slot] = node;
+}
+
+/**
+ * Internal function to delay_q. Runs every tick up to `now`: cascades
+ * the levels that wrap and collects the nodes that are due. The caller
+ * must hold `lock`.
+ * @param dq the delay queue
+ * @param now the last tick to run
+ * @return the nodes that are due, in the order they are due
+ */
+delay_q_node *__delay_q_advance(delay_q *dq, long now) { // NOLINT(bugprone-reserved-identifier)
+
+    delay_q_node *due = NULL;
+    delay_q_node *due_last = NULL;
+
+    // nothing can expire in an empty wheel, skip the ticks
+    if (dq->sz == 0 && dq->current <= now) dq->current = now + 1;
+
+    while (dq->current <= now) {
+        long idx = dq->current & SLOT_MASK;
+
+        // a wrapping level pulls the next slot of the level above
+        for (int level = 1; idx == 0 && level < DELAY_Q_LEVELS; ++level) {
+            idx = (dq->current >> (DELAY_Q_SLOT_BITS * level)) & SLOT_MASK;
+
+            delay_q_node *curr = dq->wheel[level][idx];
+            dq->wheel[level][idx] = NULL;
+
+            while (curr != NULL) {
+                delay_q_node *next = curr->next;
+                __delay_q_insert(dq, curr);
+                curr = next;
+            }
+        }
+
+        delay_q_node *curr = dq->wheel[0][dq->current & SLOT_MASK];
+        dq->wheel[0][dq->current & SLOT_MASK] = NULL;
+
+        while (curr != NULL) {
+            delay_q_node *next = curr->next;
+
+            if (curr->due <= dq->current) {
+                curr->next = NULL;
+                if (due == NULL) due = curr;
+                else due_last->next = curr;
+                due_last = curr;
+                dq->sz--;
+            } else {
+                __delay_q_insert(dq, curr);
+            }
+
+            curr = next;
+        }
+
+        dq->current++;
+    }
+
+    return due;
+}
+
+/**
+ * Internal function to delay_q. Finds the next tick when the wheel has
+ * something to do: a due slot of the first level or a cascade. The
+ * caller must hold `lock`.
+ * @param dq the delay queue
+ * @return the tick
+ */
+long __delay_q_next_tick(delay_q *dq) { // NOLINT(bugprone-reserved-identifier)
+
+    // the first level wraps, the next tick cascades
+    if ((dq->current & SLOT_MASK) == 0) return dq->current;
+
+    for (long tick = dq->current; (tick & SLOT_MASK) != 0; ++tick) {
+        if (dq->wheel[0][tick & SLOT_MASK] != NULL) return tick;
+    }
+
+    // nothing left at the first level before it wraps
+    return (dq->current | SLOT_MASK) + 1;
+}
+
+/**
+ * Internal function to delay_q. Puts due tasks in the target queue,
+ * in batches, and frees their nodes. Blocks while the target is full.
+ * Each task goes through `on_release` first, if set, and those the
+ * target refuses through `on_drop`.
+ * @param dq the delay queue
+ * @param due the nodes
+ */
+void __delay_q_release(delay_q *dq, delay_q_node *due) { // NOLINT(bugprone-reserved-identifier)
+
+    task_ptr batch[RELEASE_BATCH];
+    size_t batch_sz = 0;
+
+    while (due != NULL) {
+        delay_q_node *next = due->next;
+
+        if (dq->on_release != NULL) dq->on_release(due->data, dq->on_release_arg);
+
+        batch[batch_sz++] = due->data;
+        free(due);
+
+        if (batch_sz == RELEASE_BATCH || next == NULL) {
+            size_t put = blocking_q_put_many(dq->target, batch, batch_sz);
+
+            // the target was closed or out of memory, the rest goes back to the owner
+            for (size_t i = put; i < batch_sz; ++i) {
+                if (dq->on_drop != NULL) dq->on_drop(batch[i], dq->on_drop_arg);
+            }
+
+            dq->dropped += batch_sz - put;
+            batch_sz = 0;
+        }
+
+        due = next;
+    }
+}
+
+/**
+ * Create a delay queue.
+ * @param dq the delay queue
+ * @param target the queue tasks are put in once due
+ * @param tick_ns the resolution of release times, in nanoseconds
+ * @return if init was successful.
+ */
+bool delay_q_init(delay_q *dq, blocking_q *target, long tick_ns) {
+
+    if (tick_ns <= 0) return false;
+
+    dq->target = target;
+    dq->on_release = NULL;
+    dq->on_release_arg = NULL;
+    dq->on_drop = NULL;
+    dq->on_drop_arg = NULL;
+    dq->dropped = 0;
+    dq->epoch = monotonic_now();
+    dq->tick_ns = tick_ns;
+    dq->current = 0;
+    dq->sz = 0;
+    dq->closed = false;
+
+    for (int level = 0; level < DELAY_Q_LEVELS; ++level) {
+        for (int slot = 0; slot < DELAY_Q_SLOTS; ++slot) {
+            dq->wheel[level][slot] = NULL;
+            dq->wheel_last[level][slot] = NULL;
+        }
+    }
+
+    if (pthread_mutex_init(&dq->lock, NULL) != 0)
+        return false;
+
+    // sleeps until the next tick are measured on the monotonic clock
+    pthread_condattr_t cond_attr;
+    if (pthread_condattr_init(&cond_attr) != 0)
+        goto err_cond_attr;
+
+    if (pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC) != 0
+        || pthread_cond_init(&dq->cond, &cond_attr) != 0)
+        goto err_cond;
+
+    pthread_condattr_destroy(&cond_attr);
+
+    return true;
+
+    err_cond:
+    pthread_condattr_destroy(&cond_attr);
+    err_cond_attr:
+    pthread_mutex_destroy(&dq->lock);
+    return false;
+}
+
+/**
+ * Destroy a delay queue. Tasks still waiting are dropped, not freed.
+ * @param dq the delay queue
+ */
+void delay_q_destroy(delay_q *dq) {
+
+    for (int level = 0; level < DELAY_Q_LEVELS; ++level) {
+        for (int slot = 0; slot < DELAY_Q_SLOTS; ++slot) {
+            delay_q_node *curr = dq->wheel[level][slot];
+
+            while (curr != NULL) {
+                delay_q_node *next = curr->next;
+                free(curr);
+                curr = next;
+            }
+        }
+    }
+
+    pthread_mutex_destroy(&dq->lock);
+    pthread_cond_destroy(&dq->cond);
+}
+
+/**
+ * Have every task go through a function as it is released, e.g. to
+ * compute what the target queue orders it by. Should be set before
+ * delay_q_run starts.
+ * @param dq the delay queue
+ * @param on_release the function, NULL for none
+ * @param arg passed to the function along with the task
+ */
+void delay_q_set_on_release(delay_q *dq, delay_q_on_release on_release, void *arg) {
+    dq->on_release = on_release;
+    dq->on_release_arg = arg;
+}
+
+/**
+ * Hand the tasks the target queue refuses to a function, e.g. to free
+ * them. Should be set before delay_q_run starts.
+ * @param dq the delay queue
+ * @param on_drop the function, NULL for none
+ * @param arg passed to the function along with the task
+ */
+void delay_q_set_on_drop(delay_q *dq, delay_q_on_drop on_drop, void *arg) {
+    dq->on_drop = on_drop;
+    dq->on_drop_arg = arg;
+}
+
+/**
+ * Hold a task until its release time. This can fail if no memory is
+ * available for a new entry or the delay queue was closed.
+ * @param dq the delay queue
+ * @param data the task
+ * @param release when to put the task in the target queue, on the
+ * clock of monotonic_now. It is rounded up to the next tick.
+ * @return if the task will be released
+ */
+bool delay_q_put(delay_q *dq, task_ptr data, long release) {
+
+    delay_q_node *node = malloc(sizeof(delay_q_node));
+    if (node == NULL) return false;
+
+    node->data = data;
+
+    pthread_mutex_lock(&dq->lock);
+
+    if (dq->closed) {
+        pthread_mutex_unlock(&dq->lock);
+        free(node);
+        return false;
+    }
+
+    long since_epoch = release - dq->epoch;
+    node->due = since_epoch <= 0 ? 0 : (since_epoch + dq->tick_ns - 1) / dq->tick_ns;
+
+    __delay_q_insert(dq, node);
+    dq->sz++;
+
+    // the task may be due before the wheel planned to wake up
+    pthread_cond_signal(&dq->cond);
+
+    pthread_mutex_unlock(&dq->lock);
+
+    return true;
+}
+
+/**
+ * Stop accepting tasks. Tasks already held are still released on
+ * time, then delay_q_run closes the target queue.
+ * @param dq the delay queue
+ */
+void delay_q_close(delay_q *dq) {
+    pthread_mutex_lock(&dq->lock);
+    dq->closed = true;
+    pthread_cond_signal(&dq->cond);
+    pthread_mutex_unlock(&dq->lock);
+}
+
+/**
+ * Code executed by the thread advancing the wheel. It sleeps until
+ * the next tick with something to do, releases due tasks and returns
+ * once the delay queue is closed and empty, after closing the target.
+ * @param v_dq the delay queue
+ * @return NULL
+ */
+void *delay_q_run(void *v_dq) {
+    delay_q *dq = (delay_q *) v_dq;
+
+    pthread_mutex_lock(&dq->lock);
+
+    for (;;) {
+        long now = (monotonic_now() - dq->epoch) / dq->tick_ns;
+        delay_q_node *due = __delay_q_advance(dq, now);
+
+        if (due != NULL) {
+            // the target may block, new tasks can come in meanwhile
+            pthread_mutex_unlock(&dq->lock);
+            __delay_q_release(dq, due);
+            pthread_mutex_lock(&dq->lock);
+            continue;
+        }
+
+        if (dq->sz == 0 && dq->closed) break;
+
+        if (dq->sz == 0) {
+            pthread_cond_wait(&dq->cond, &dq->lock);
+        } else {
+            long wake = dq->epoch + __delay_q_next_tick(dq) * dq->tick_ns;
+            struct timespec deadline = {
+                    .tv_sec = wake / 1000000000L,
+                    .tv_nsec = wake % 1000000000L,
+            };
+            pthread_cond_timedwait(&dq->cond, &dq->lock, &deadline);
+        }
+    }
+
+    pthread_mutex_unlock(&dq->lock);
+
+    blocking_q_close(dq->target);
+
+    return NULL;
+}
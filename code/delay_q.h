@@ -0,0 +1,85 @@
+#ifndef DELAY_Q_H
+#define DELAY_Q_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "blocking_q.h"
+
+// The wheel has DELAY_Q_LEVELS levels of DELAY_Q_SLOTS slots, each
+// level counting ticks DELAY_Q_SLOTS times coarser than the previous.
+#define DELAY_Q_SLOT_BITS 6
+#define DELAY_Q_SLOTS (1 << DELAY_Q_SLOT_BITS)
+#define DELAY_Q_LEVELS 4
+
+typedef struct delay_q_node {
+    task_ptr data;
+    long due;
+    struct delay_q_node *next;
+} delay_q_node;
+
+/**
+ * Called on every task as it is released, before it is put in the
+ * target queue, with the argument given to delay_q_set_on_release.
+ */
+typedef void (*delay_q_on_release)(task_ptr data, void *arg);
+
+/**
+ * Called on every due task the target queue refused, being closed or
+ * out of memory, with the argument given to delay_q_set_on_drop. The
+ * delay queue no longer refers to the task, it may be freed.
+ */
+typedef void (*delay_q_on_drop)(task_ptr data, void *arg);
+
+/**
+ * Holds tasks until their release time, then puts them in a target
+ * blocking queue, so they only become visible to blocking_q_get once
+ * due.
+ *
+ * Hierarchical timer wheel: a task is appended to the slot of its due
+ * tick at the lowest level whose range covers it, in O(1). When a level
+ * wraps, the next slot of the level above is cascaded down. Each task
+ * is moved at most once per level, so expiry is amortized O(1).
+ * Slots are FIFO, so tasks due on the same tick and put on the same
+ * tick are released in the order they were put. A task put later but
+ * closer to its due tick can skip a level and come out first.
+ *
+ * `current` is the next tick to process, ticks count `tick_ns`
+ * nanoseconds since `epoch`. A thread running delay_q_run advances
+ * the wheel and calls `on_release` on the due tasks, outside `lock`.
+ * Tasks the target refuses go to `on_drop` and are counted in
+ * `dropped`, which is only read once delay_q_run returned.
+ */
+typedef struct delay_q {
+    blocking_q *target;
+    delay_q_on_release on_release;
+    void *on_release_arg;
+    delay_q_on_drop on_drop;
+    void *on_drop_arg;
+    size_t dropped;
+    long epoch;
+    long tick_ns;
+    long current;
+    size_t sz;
+    bool closed;
+    delay_q_node *wheel[DELAY_Q_LEVELS][DELAY_Q_SLOTS];
+    delay_q_node *wheel_last[DELAY_Q_LEVELS][DELAY_Q_SLOTS];
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} delay_q;
+
+bool delay_q_init(delay_q *dq, blocking_q *target, long tick_ns);
+
+void delay_q_destroy(delay_q *dq);
+
+void delay_q_set_on_release(delay_q *dq, delay_q_on_release on_release, void *arg);
+
+void delay_q_set_on_drop(delay_q *dq, delay_q_on_drop on_drop, void *arg);
+
+bool delay_q_put(delay_q *dq, task_ptr data, long release);
+
+void delay_q_close(delay_q *dq);
+
+void *delay_q_run(void *v_dq);
+
+#endif //DELAY_Q_H
@@ -0,0 +1,104 @@
+#include <string.h>
+#include "histogram.h"
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
+
+/**
+ * Internal function to histogram. Bucket of a value: the value itself
+ * below 2 * HISTOGRAM_SUB, otherwise its HISTOGRAM_SUB_BITS + 1 most
+ * significant bits after the bucket of the values half as large.
+ * @param value the value, not negative
+ * @return the bucket
+ */
+int __histogram_bucket(long value) { // NOLINT(bugprone-reserved-identifier)
+
+    if (value < 2 * HISTOGRAM_SUB) return (int) value;
+
+    int shift = 63 - __builtin_clzl((unsigned long) value) - HISTOGRAM_SUB_BITS;
+    int sub = (int) (value >> shift) - HISTOGRAM_SUB;
+
+    return HISTOGRAM_SUB + shift * HISTOGRAM_SUB + sub;
+}
+
+/**
+ * Internal function to histogram. Highest value of a bucket.
+ * @param bucket the bucket
+ * @return the value
+ */
+long __histogram_value(int bucket) { // NOLINT(bugprone-reserved-identifier)
+
+    if (bucket < 2 * HISTOGRAM_SUB) return bucket;
+
+    int shift = bucket / HISTOGRAM_SUB - 1;
+    unsigned long sub = bucket % HISTOGRAM_SUB + HISTOGRAM_SUB;
+
+    return (long) (((sub + 1) << shift) - 1);
+}
+
+/**
+ * Create an empty histogram.
+ * @param h the histogram
+ */
+void histogram_init(histogram *h) {
+    memset(h, 0, sizeof(histogram));
+}
+
+/**
+ * Record a value. Only the thread owning the histogram may call it.
+ * @param h the histogram
+ * @param value the value, negative ones count as 0
+ */
+void histogram_record(histogram *h, long value) {
+
+    if (value < 0) value = 0;
+
+    ++h->buckets[__histogram_bucket(value)];
+    ++h->count;
+
+    if (value > h->max) h->max = value;
+}
+
+/**
+ * Add the values of a histogram to another one. No thread may record
+ * in either of them meanwhile.
+ * @param into the histogram receiving the values
+ * @param h the histogram whose values are added
+ */
+void histogram_merge(histogram *into, const histogram *h) {
+
+    for (int i = 0; i < HISTOGRAM_BUCKETS; ++i)
+        into->buckets[i] += h->buckets[i];
+
+    into->count += h->count;
+
+    if (h->max > into->max) into->max = h->max;
+}
+
+/**
+ * Value below which a percentage of the recorded values fall, up to
+ * the precision of the buckets.
+ * @param h the histogram
+ * @param percentile the percentage, from 0 to 100
+ * @return the value, 0 if the histogram is empty
+ */
+long histogram_percentile(const histogram *h, double percentile) {
+
+    if (0 == h->count) return 0;
+
+    uint64_t rank = (uint64_t) (percentile / 100.0 * (double) h->count + 0.5);
+    if (rank < 1) rank = 1;
+
+    uint64_t seen = 0;
+
+    for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        seen += h->buckets[i];
+
+        if (seen >= rank) {
+            long value = __histogram_value(i);
+            return value < h->max ? value : h->max;
+        }
+    }
+
+    return h->max;
+}
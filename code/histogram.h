@@ -0,0 +1,34 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+// Every power of two is split in 2^HISTOGRAM_SUB_BITS linear buckets,
+// a recorded value is off by less than 1 / 2^HISTOGRAM_SUB_BITS, 3 %
+#define HISTOGRAM_SUB_BITS 5
+#define HISTOGRAM_SUB (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS) * HISTOGRAM_SUB)
+
+/**
+ * Log-linear histogram of non-negative values, in the manner of HDR
+ * histograms. Values below 2 * HISTOGRAM_SUB are exact, larger ones
+ * fall in a bucket of their power of two.
+ *
+ * A histogram belongs to a single thread and needs no lock, those of
+ * several threads are merged once they stopped recording.
+ */
+typedef struct histogram {
+    uint64_t count;
+    long max;
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+} histogram;
+
+void histogram_init(histogram *h);
+
+void histogram_record(histogram *h, long value);
+
+void histogram_merge(histogram *into, const histogram *h);
+
+long histogram_percentile(const histogram *h, double percentile);
+
+#endif //HISTOGRAM_H
@@ -1,10 +1,22 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <time.h>
+#include <sched.h>
 #include <pthread.h>
 #include "blocking_q.h"
+#include "delay_q.h"
+#include "monotonic.h"
+#include "cpu_topology.h"
+#include "task.h"
+#include "processor.h"
+#include "sched_policy.h"
 #include "main.h"
 
 #pragma clang diagnostic push
@@ -12,120 +24,128 @@
 
 #define TODO printf("TODO");
 
-#define TASK_A_T (5 * 1000)
-#define TASK_B_T (10 * 1000)
-#define TASK_C_T (15 * 1000)
-#define TASK_D_T (20 * 1000)
-
-#define PROCESSOR_COUNT 4
-
-#define POISON_PILL 'K'
+// Environment variable overriding the size of the processor pool, the
+// second argument overrides both it and the amount of usable CPUs
+#define PROCESSOR_COUNT_ENV "PROCESSOR_COUNT"
+
+// Environment variable pinning the threads to CPUs when set to 1: each
+// processor to its own core, the scheduler side to a core of its own
+#define PIN_THREADS_ENV "PIN_THREADS"
+
+// Storage of the queues. The scheduler queue is bounded so that the
+// fill loop of main waits for the scheduler instead of growing memory,
+// and hands out the cheapest tasks first, by the cost learned when they
+// are released, or the earliest deadlines.
+// Consumers spin up to SCHED_Q_SPIN times before parking.
+#define SCHED_Q_KIND BLOCKING_Q_HEAP
+#define SCHED_Q_KEY task_expected_cost
+#define SCHED_Q_CAPACITY 1024
+#define SCHED_Q_SPIN 4096
+
+// The pool starts with a share of the processors and never runs less.
+// The scheduler has it grow when tasks arrive and every
+// POOL_CHECK_INTERVAL, 10 ms, see processor_pool_grow.
+#define POOL_MIN_SHARE 4
+#define POOL_CHECK_INTERVAL (10 * 1000 * 1000)
+
+// Environment variable naming the scheduling policy, the third argument
+// overrides it. See sched_policy_find for the names.
+#define SCHED_POLICY_ENV "SCHED_POLICY"
+#define SCHED_POLICY_DEFAULT "least-expected-work"
+
+// Environment variable giving the deadline of each task type relative to
+// its release, in milliseconds: "A,B,C,D", 0 or nothing for none. Tasks
+// are then run earliest deadline first, unless EDF_ENV is set to 0, the
+// misses are counted in both cases.
+#define TASK_DEADLINES_ENV "TASK_DEADLINES"
+#define EDF_ENV "EDF"
+
+// Maximum amount of tasks the scheduler takes from its queue at once
+#define SCHED_Q_BATCH 64
+
+// Resolution of the release times of the tasks, 1 ms
+#define DELAY_Q_TICK (1000 * 1000)
 
 /**
- * Code executed by task A
+ * Size of the processor pool: the override given as argument or in
+ * the environment if any, otherwise one processor per CPU this
+ * process may run on.
+ * @param arg the override given as argument, NULL if none
+ * @return the amount of processors, at least 1
  */
-long task_a() {
-    printf("Task A starting...\n");
-    sleep(5);
-    printf("Task A ending...\n");
-    return TASK_A_T;
-}
+int processor_count(const char *arg) {
 
-/**
- * Code executed by task B
- */
-long task_b() {
-    printf("Task B starting...\n");
-    sleep(10);
-    printf("Task B ending...\n");
-    return TASK_B_T;
-}
+    if (NULL == arg) arg = getenv(PROCESSOR_COUNT_ENV);
 
-/**
- * Code executed by task C
- */
-long task_c() {
-    printf("Task C starting...\n");
-    sleep(15);
-    printf("Task C starting...\n");
-    return TASK_C_T;
-}
+    if (NULL != arg) {
+        int count = atoi(arg);
+        if (count > 0) return count;
+    }
 
-/**
- * Code executed by task D
- */
-long task_d() {
-    printf("Task D starting...\n");
-    sleep(20);
-    printf("Task D starting...\n");
-    return TASK_D_T;
-}
+    cpu_set_t cpus;
+    if (0 == sched_getaffinity(0, sizeof(cpu_set_t), &cpus) && CPU_COUNT(&cpus) > 0)
+        return CPU_COUNT(&cpus);
 
-/**
- * Initialises a processor structure. This can fail if there is no
- * memory for a tasks list, it's initialisation fails or the mutex
- * cannot be created.
- * @param id the ID of the processor
- * @param p the processor
- * @return if the initialization was successful
- */
-bool processor_init(int id, processor *p) {
-    TODO
-    return true;
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    return online > 0 ? (int) online : 1;
 }
 
 /**
- * Destroy a processor structure
- * @param p ptr to the structure
+ * Check if the threads are pinned to CPUs, see PIN_THREADS_ENV
+ * @return if the threads are pinned
  */
-void processor_destroy(processor *p) {
-    TODO
-}
-
-void *processor_run(void *v_self) {
-    TODO
-    return NULL;
+bool pin_threads(void) {
+    const char *pin = getenv(PIN_THREADS_ENV);
+    return NULL != pin && 0 != atoi(pin);
 }
 
 
 void *scheduler(void *v_sched_data) {
     sched_data *data = (sched_data *) v_sched_data;
     blocking_q *q = data->sched_q;
-    processor *p = data->processors;
+    sched_policy *policy = data->pool->policy;
 
-    bool run = true;
+    // Tasks are pulled from the scheduler queue in batches
+    task_ptr batch[SCHED_Q_BATCH];
+    size_t batch_sz;
 
-    while (run) {
-        task_ptr t = blocking_q_get(q);
-        printf("Received t %c\n", t->type);
+    // main closes the queue once every task is in it
+    for (;;) {
+        batch_sz = blocking_q_drain_at_least_timeout(q, batch, SCHED_Q_BATCH, 1, POOL_CHECK_INTERVAL);
 
-        /// ------------------------------------------------------------------
-        ///           EXERCICE 2.4 DANS LE BLOC LEXICAL SUIVANT
-        /// ------------------------------------------------------------------
-        {
-            // ICI!
-        }
-        /// ------------------------------------------------------------------
-        ///                NE PAS TOUCHER APRÈS CETTE LIGNE
-        /// ------------------------------------------------------------------
+        if (0 == batch_sz && blocking_q_is_closed(q) && 0 == blocking_q_size(q)) break;
 
+        // Add processors if the tasks pile up, even when none arrive
+        processor_pool_grow(data->pool, q, batch_sz);
 
-        if (POISON_PILL == t->type) {
-            run = false;
-        }
-    }
+        for (size_t i = 0; i < batch_sz; ++i) {
+            task_ptr t = batch[i];
+            printf("Received t %c\n", t->type);
+
+            /// --------------------------------------------------------------
+            ///         EXERCICE 2.4 DANS LE BLOC LEXICAL SUIVANT
+            /// --------------------------------------------------------------
+            {
+                // policies may refine the learned cost
+                t->cost = processor_pool_expected_cost(data->pool, t);
+                sched_policy_task_arrival(policy, t);
 
-    // Stop the processors
-    task_ptr poison = malloc(sizeof(task));
-    poison->type = POISON_PILL;
+                // A retiring processor refuses the task, pick again
+                for (;;) {
+                    processor *target = sched_policy_pick_processor(policy, t);
 
-    for (int i = 0; i < PROCESSOR_COUNT; ++i) {
-        processor *proc = data->processors + i;
-        // kill all processors
-        blocking_q_put(proc->tasks, poison);
+                    if (NULL != target && processor_dispatch(target, t)) break;
+                    if (NULL == target) sched_yield();
+                }
+            }
+            /// --------------------------------------------------------------
+            ///              NE PAS TOUCHER APRÈS CETTE LIGNE
+            /// --------------------------------------------------------------
+        }
     }
 
-    free(poison);
+    // Stop the processors once they ran the tasks already queued
+    processor_pool_stop(data->pool);
 
     return NULL;
 }
@@ -151,41 +171,101 @@ int main(int argc, char **argv) {
     }
 
     // Start threads
-    blocking_q *sched_q = malloc(sizeof(blocking_q));
+    blocking_q *sched_q = aligned_alloc(BLOCKING_Q_CACHE_LINE, sizeof(blocking_q));
+
+    if (NULL == sched_q || !blocking_q_init_with(sched_q, SCHED_Q_KIND, SCHED_Q_CAPACITY)) {
+        return EXIT_FAILURE;
+    }
+
+    long deadlines[TASK_TYPES];
+    const char *edf_env = getenv(EDF_ENV);
+    bool edf = task_deadlines(getenv(TASK_DEADLINES_ENV), deadlines) && (NULL == edf_env || 0 != atoi(edf_env));
+
+    blocking_q_set_spin(sched_q, SCHED_Q_SPIN);
+    blocking_q_set_key(sched_q, edf ? task_deadline : SCHED_Q_KEY);
+
+    int processor_c = processor_count(argc > 2 ? argv[2] : NULL);
+
+    const char *policy_name = argc > 3 ? argv[3] : getenv(SCHED_POLICY_ENV);
+    if (NULL == policy_name) policy_name = SCHED_POLICY_DEFAULT;
+
+    const sched_policy_ops *policy_ops = sched_policy_find(policy_name);
 
-    if (NULL == sched_q || !blocking_q_init(sched_q)) {
+    if (NULL == policy_ops) {
+        printf("Unknown scheduling policy %s.\n", policy_name);
         return EXIT_FAILURE;
     }
 
     pthread_t sched_thread;
-    pthread_t processor_threads[PROCESSOR_COUNT];
-    processor processors[PROCESSOR_COUNT];
+    processor_pool pool;
 
-    sched_data data;
-    data.sched_q = sched_q;
-    data.processors = processors;
+    sched_policy policy;
+
+    if (!processor_pool_init(&pool, processor_c / POOL_MIN_SHARE, processor_c, edf)) {
+        return EXIT_FAILURE;
+    }
 
-    if (0 != pthread_create(&sched_thread, NULL, scheduler, (void *) &data)) {
+    if (!sched_policy_init(&policy, policy_ops, &pool)) {
         return EXIT_FAILURE;
     }
 
-    long start = time(NULL);
-    for (int i = 0; i < PROCESSOR_COUNT; ++i) {
+    pool.policy = &policy;
+
+    // Keep the scheduler side and each processor on their own cores
+    cpu_topology topo = {NULL, 0, NULL, 0};
+    pthread_attr_t sched_attr;
 
-        if (!processor_init(i, processors + i)) {
+    if (pin_threads()) {
+
+        if (!cpu_topology_init(&topo)) {
             return EXIT_FAILURE;
         }
 
-        if (0 != pthread_create(processor_threads + i,
-                                NULL,
-                                processor_run,
-                                (void *) (processors + i))) {
+        for (int i = 0; i < pool.max; ++i) {
+            pool.processors[i].cpu = cpu_topology_processor_cpu(&topo, i);
+        }
+    }
+
+    if (!thread_attr_init(&sched_attr, topo.sched_cpus, topo.sched_cpu_c)) {
+        return EXIT_FAILURE;
+    }
+
+    long start = monotonic_now();
+
+    // Processors steal from each other, all must be ready first
+    for (int i = 0; i < pool.min; ++i) {
 
+        if (!processor_start(pool.processors + i)) {
             return EXIT_FAILURE;
         }
     }
 
+    sched_data data;
+    data.sched_q = sched_q;
+    data.processors = pool.processors;
+    data.pool = &pool;
+
+    if (0 != pthread_create(&sched_thread, &sched_attr, scheduler, (void *) &data)) {
+        return EXIT_FAILURE;
+    }
+
+    // Tasks are held until their release time, the trace is read at once
+    delay_q delays;
+    pthread_t delay_thread;
+
+    if (!delay_q_init(&delays, sched_q, DELAY_Q_TICK)) {
+        return EXIT_FAILURE;
+    }
+
+    delay_q_set_on_release(&delays, processor_pool_estimate, &pool);
+    delay_q_set_on_drop(&delays, task_drop, NULL);
+
+    if (0 != pthread_create(&delay_thread, &sched_attr, delay_q_run, (void *) &delays)) {
+        return EXIT_FAILURE;
+    }
+
     char *tasks_and_times = argv[1];
+    long release = monotonic_now();
 
     // Fill the task queue
     unsigned long task_c = strlen(tasks_and_times);
@@ -199,8 +279,12 @@ int main(int argc, char **argv) {
             case 'D': {
                 task_ptr t = (task_ptr) malloc(sizeof(task));
                 t->type = task_type;
-                t->start = t->end = 0;
-                blocking_q_put(sched_q, t);
+                t->processor = -1;
+                t->cost = 0;
+                t->enqueued = release;
+                t->deadline = 0 != deadlines[task_type - 'A'] ? release + deadlines[task_type - 'A'] : 0;
+                t->dispatched = t->start = t->end = 0;
+                delay_q_put(&delays, t, release);
                 break;
             }
             case '0':
@@ -213,26 +297,33 @@ int main(int argc, char **argv) {
             case '7':
             case '8':
             case '9':
-                sleep(task_type - '0');
+                release += (task_type - '0') * 1000000000L;
                 break;
             default:
                 break;
         }
     }
 
-    task_ptr poison_pill_task = malloc(sizeof(task));
-    poison_pill_task->type = POISON_PILL;
+    // No more tasks, the scheduler queue is closed once the rest is released
+    delay_q_close(&delays);
 
-    blocking_q_put(sched_q, poison_pill_task);
+    pthread_join(delay_thread, NULL);
+    size_t dropped = delays.dropped;
+    delay_q_destroy(&delays);
 
     pthread_join(sched_thread, NULL);
 
     printf("\n\n");
 
-    for (int i = 0; i < PROCESSOR_COUNT; ++i) {
-        pthread_join(processor_threads[i], NULL);
+    processor_pool_join(&pool);
+
+    // Processors that ran, their structure kept the accounting across threads.
+    // Times are in nanoseconds.
+    for (int i = 0; i < pool.max; ++i) {
+        processor *p = pool.processors + i;
+
+        if (0 == p->real_t) continue;
 
-        processor *p = processors + i;
         printf("Processor %d: Real T: %ld Work T: %ld Wait T: %ld\n",
                i,
                p->real_t,
@@ -240,12 +331,21 @@ int main(int argc, char **argv) {
                p->wait_t);
     }
 
-    long end = time(NULL);
+    long end = monotonic_now();
     long elapsed = end - start;
 
-    printf("Elapsed: %ld\n", elapsed);
+    printf("Policy: %s%s\n", policy.ops->name, edf ? ", earliest deadline first" : "");
+    printf("Elapsed: %ld.%09ld s\n", elapsed / 1000000000L, elapsed % 1000000000L);
+    if (0 != dropped) printf("Dropped: %zu tasks the scheduler queue refused\n", dropped);
+
+    processor_pool_print_latencies(&pool);
+
+    // Processors may steal from each other until the last one stops
+    sched_policy_destroy(&policy);
+    processor_pool_destroy(&pool);
 
-    free(poison_pill_task);
+    pthread_attr_destroy(&sched_attr);
+    cpu_topology_destroy(&topo);
 
     return EXIT_SUCCESS;
 }
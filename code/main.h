@@ -0,0 +1,24 @@
+#ifndef MAIN_H
+#define MAIN_H
+
+#include <stdbool.h>
+#include "blocking_q.h"
+#include "task.h"
+#include "processor.h"
+
+/**
+ * Data handed to the scheduler thread.
+ */
+typedef struct sched_data {
+    blocking_q *sched_q;
+    processor *processors;
+    processor_pool *pool;
+} sched_data;
+
+int processor_count(const char *arg);
+
+bool pin_threads(void);
+
+void *scheduler(void *v_sched_data);
+
+#endif //MAIN_H
@@ -0,0 +1,16 @@
+#include <time.h>
+#include "monotonic.h"
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
+
+/**
+ * Current time of the monotonic clock, the clock every time stamp,
+ * release time and deadline is taken on.
+ * @return the time in nanoseconds
+ */
+long monotonic_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
@@ -0,0 +1,6 @@
+#ifndef MONOTONIC_H
+#define MONOTONIC_H
+
+long monotonic_now(void);
+
+#endif //MONOTONIC_H
@@ -0,0 +1,613 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include "blocking_q.h"
+#include "monotonic.h"
+#include "sched_policy.h"
+#include "processor.h"
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
+
+/**
+ * Initialises the attributes of a thread running on some CPUs only.
+ * @param attr the attributes
+ * @param cpus the CPUs
+ * @param cpu_c the amount of CPUs, the thread runs anywhere if 0
+ * @return if the initialisation was successful
+ */
+bool thread_attr_init(pthread_attr_t *attr, const int *cpus, int cpu_c) {
+
+    if (0 != pthread_attr_init(attr)) return false;
+    if (0 == cpu_c) return true;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    for (int i = 0; i < cpu_c; ++i) CPU_SET(cpus[i], &set);
+
+    if (0 != pthread_attr_setaffinity_np(attr, sizeof(cpu_set_t), &set)) {
+        pthread_attr_destroy(attr);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Initialises a processor structure. This can fail if there is no
+ * memory for a tasks list, it's initialisation fails or the mutex
+ * cannot be created.
+ * @param id the ID of the processor
+ * @param p the processor
+ * @param edf if the tasks list hands out the earliest deadline first
+ * @return if the initialization was successful
+ */
+bool processor_init(int id, processor *p, bool edf) {
+
+    p->id = id;
+    p->state = PROCESSOR_STOPPED;
+    p->dispatching = false;
+    p->outstanding = 0;
+    p->outstanding_cost = 0;
+    p->started = false;
+    p->cpu = -1;
+    p->pool = NULL;
+    p->real_t = 0;
+    p->work_t = 0;
+    p->wait_t = 0;
+
+    for (int type = 0; type < TASK_TYPES; ++type)
+        p->deadline_met[type] = p->deadline_missed[type] = 0;
+
+    p->tasks = aligned_alloc(BLOCKING_Q_CACHE_LINE, sizeof(blocking_q));
+    if (p->tasks == NULL) return false;
+
+    // With EDF, a heap hands out the earliest deadline first
+    if (!blocking_q_init_with(p->tasks, edf ? BLOCKING_Q_HEAP : PROCESSOR_Q_KIND, PROCESSOR_Q_CAPACITY)) {
+        free(p->tasks);
+        return false;
+    }
+
+    blocking_q_set_spin(p->tasks, PROCESSOR_Q_SPIN);
+    if (edf) blocking_q_set_key(p->tasks, task_deadline);
+
+    if (!ws_deque_init(&p->deque, PROCESSOR_DEQUE_CAPACITY)) {
+        blocking_q_destroy(p->tasks);
+        free(p->tasks);
+        return false;
+    }
+
+    p->latency = malloc(sizeof(histogram[TASK_LATENCIES]) * TASK_TYPES);
+    if (p->latency == NULL) {
+        ws_deque_destroy(&p->deque);
+        blocking_q_destroy(p->tasks);
+        free(p->tasks);
+        return false;
+    }
+
+    for (int type = 0; type < TASK_TYPES; ++type)
+        for (int l = 0; l < TASK_LATENCIES; ++l)
+            histogram_init(&p->latency[type][l]);
+
+    if (0 != pthread_mutex_init(&p->lock, NULL)) {
+        free(p->latency);
+        ws_deque_destroy(&p->deque);
+        blocking_q_destroy(p->tasks);
+        free(p->tasks);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Destroy a processor structure
+ * @param p ptr to the structure
+ */
+void processor_destroy(processor *p) {
+    ws_deque_destroy(&p->deque);
+    blocking_q_destroy(p->tasks);
+    free(p->tasks);
+    free(p->latency);
+    pthread_mutex_destroy(&p->lock);
+}
+
+/**
+ * Start a thread running a stopped processor, after joining the one
+ * that ran it before, on the CPU of the processor if it has one. Only
+ * the thread managing the pool may call it.
+ * @param p the processor
+ * @return if the thread could be created
+ */
+bool processor_start(processor *p) {
+
+    if (p->started) {
+        pthread_join(p->thread, NULL);
+        p->started = false;
+    }
+
+    pthread_attr_t attr;
+    if (!thread_attr_init(&attr, &p->cpu, p->cpu < 0 ? 0 : 1)) return false;
+
+    atomic_store(&p->state, PROCESSOR_RUNNING);
+    atomic_fetch_add(&p->pool->active, 1);
+
+    p->started = 0 == pthread_create(&p->thread, &attr, processor_run, (void *) p);
+    pthread_attr_destroy(&attr);
+
+    if (!p->started) {
+        atomic_fetch_sub(&p->pool->active, 1);
+        atomic_store(&p->state, PROCESSOR_STOPPED);
+    }
+
+    return p->started;
+}
+
+/**
+ * Hand a task to a running processor. Only the scheduler may call it.
+ * @param p the processor
+ * @param t the task
+ * @return if the processor took the task, false if it is not running
+ */
+bool processor_dispatch(processor *p, task_ptr t) {
+
+    // A retiring processor waits for the flag to drop before its last drain
+    atomic_store(&p->dispatching, true);
+
+    t->dispatched = monotonic_now();
+    t->processor = p->id;
+    atomic_fetch_add(&p->outstanding, 1);
+    atomic_fetch_add(&p->outstanding_cost, t->cost);
+
+    bool ok = PROCESSOR_RUNNING == atomic_load(&p->state) && blocking_q_put(p->tasks, t);
+
+    if (!ok) {
+        atomic_fetch_sub(&p->outstanding, 1);
+        atomic_fetch_sub(&p->outstanding_cost, t->cost);
+    }
+
+    atomic_store(&p->dispatching, false);
+    return ok;
+}
+
+/**
+ * Retire an idle processor, unless the pool would shrink below its
+ * minimum. Runs every task it was handed before it stopped taking any.
+ * Only the processor itself may call it.
+ * @param self the processor
+ * @return if the processor retired, its thread must then return
+ */
+bool processor_retire(processor *self) {
+    processor_pool *pool = self->pool;
+    int active = atomic_load(&pool->active);
+
+    do {
+        if (active <= pool->min || atomic_load(&pool->stopping)) return false;
+    } while (!atomic_compare_exchange_weak(&pool->active, &active, active - 1));
+
+    atomic_store(&self->state, PROCESSOR_RETIRING);
+
+    // A dispatch that saw the processor running may still be putting its
+    // task, keep draining so that it never blocks on a full queue.
+    for (;;) {
+        bool dispatching = atomic_load(&self->dispatching);
+        task_ptr t;
+
+        while (NULL != (t = blocking_q_try_get(self->tasks))
+               || NULL != (t = ws_deque_take(&self->deque)))
+            processor_execute(self, t);
+
+        if (!dispatching) break;
+        sched_yield();
+    }
+
+    atomic_store(&self->state, PROCESSOR_STOPPED);
+    return true;
+}
+
+/**
+ * Steal a task from another processor of the pool, trying every one of
+ * them once from a random start. Takes the oldest task of its deque,
+ * otherwise the next one of its queue: a processor busy with a long
+ * task does not move its queue to its deque meanwhile. With EDF, the
+ * deques are empty and a queue hands out its earliest deadline.
+ * @param self the idle processor
+ * @param seed the state of the processor's random generator
+ * @return the task, NULL if nothing could be stolen
+ */
+task_ptr processor_steal(processor *self, unsigned int *seed) {
+    processor_pool *pool = self->pool;
+
+    if (pool->max < 2) return NULL;
+
+    int start = rand_r(seed) % pool->max;
+
+    // Stopped processors have empty deques and queues
+    for (int i = 0; i < pool->max; ++i) {
+        processor *victim = pool->processors + (start + i) % pool->max;
+        if (victim == self) continue;
+
+        task_ptr t = ws_deque_steal(&victim->deque);
+        if (t == NULL) t = blocking_q_try_get(victim->tasks);
+        if (t != NULL) return t;
+    }
+
+    return NULL;
+}
+
+/**
+ * Initialises a pool of max processors, none of them running. This
+ * can fail if there is no memory for them or one of them cannot be
+ * initialised.
+ * @param pool the pool
+ * @param min the minimum amount of running processors
+ * @param max the maximum amount of running processors
+ * @param edf if the processors run the earliest deadline first
+ * @return if the initialisation was successful
+ */
+bool processor_pool_init(processor_pool *pool, int min, int max, bool edf) {
+
+    // Each processor starts on its own cache lines
+    size_t processors_sz = sizeof(processor) * max;
+    processors_sz = (processors_sz + BLOCKING_Q_CACHE_LINE - 1) & ~(size_t) (BLOCKING_Q_CACHE_LINE - 1);
+
+    pool->processors = aligned_alloc(BLOCKING_Q_CACHE_LINE, processors_sz);
+    if (NULL == pool->processors) return false;
+
+    pool->min = min < 1 ? 1 : min > max ? max : min;
+    pool->max = max;
+    pool->edf = edf;
+    pool->active = 0;
+    pool->stopping = false;
+    pool->policy = NULL;
+
+    // The nominal costs only hold until the first tasks complete
+    for (int type = 0; type < TASK_TYPES; ++type) {
+        task nominal = {.type = (char) ('A' + type)};
+        cost_model_init(&pool->costs[type], task_cost(&nominal) * TASK_T_NS);
+    }
+
+    for (int i = 0; i < max; ++i) {
+
+        if (!processor_init(i, pool->processors + i, edf)) {
+            while (i-- > 0) processor_destroy(pool->processors + i);
+            free(pool->processors);
+            return false;
+        }
+
+        pool->processors[i].pool = pool;
+    }
+
+    return true;
+}
+
+/**
+ * Destroy a pool once every processor thread was joined
+ * @param pool the pool
+ */
+void processor_pool_destroy(processor_pool *pool) {
+
+    for (int i = 0; i < pool->max; ++i) {
+        processor_destroy(pool->processors + i);
+    }
+
+    free(pool->processors);
+}
+
+/**
+ * Start as many processors as it takes for the outstanding tasks to
+ * be under the high-water mark again: those in the scheduler queue,
+ * those about to be dispatched and those handed to processors, queued
+ * or running. Only the scheduler may call it.
+ * @param pool the pool
+ * @param sched_q the scheduler queue
+ * @param arriving the tasks taken from the scheduler queue and not
+ * dispatched yet
+ * @return the amount of processors started
+ */
+int processor_pool_grow(processor_pool *pool, blocking_q *sched_q, size_t arriving) {
+    int active = atomic_load(&pool->active);
+
+    if (active >= pool->max || atomic_load(&pool->stopping)) return 0;
+
+    size_t pending = blocking_q_size(sched_q) + arriving;
+
+    for (int i = 0; i < pool->max; ++i) {
+        long outstanding = atomic_load(&pool->processors[i].outstanding);
+        if (outstanding > 0) pending += (size_t) outstanding;
+    }
+
+    size_t wanted = (pending + POOL_HIGH_WATER - 1) / POOL_HIGH_WATER;
+    if (wanted > (size_t) pool->max) wanted = (size_t) pool->max;
+
+    int started = 0;
+
+    for (int i = 0; i < pool->max && (size_t) (active + started) < wanted; ++i) {
+        processor *p = pool->processors + i;
+
+        if (PROCESSOR_STOPPED == atomic_load(&p->state) && processor_start(p))
+            ++started;
+    }
+
+    return started;
+}
+
+/**
+ * Stop the pool: no processor retires or starts anymore and the running
+ * ones stop once they ran the tasks already queued.
+ * @param pool the pool
+ */
+void processor_pool_stop(processor_pool *pool) {
+    atomic_store(&pool->stopping, true);
+
+    for (int i = 0; i < pool->max; ++i) {
+        blocking_q_close(pool->processors[i].tasks);
+    }
+}
+
+/**
+ * Wait for every processor thread of a stopped pool to return
+ * @param pool the pool
+ */
+void processor_pool_join(processor_pool *pool) {
+
+    for (int i = 0; i < pool->max; ++i) {
+        processor *p = pool->processors + i;
+
+        if (p->started) {
+            pthread_join(p->thread, NULL);
+            p->started = false;
+        }
+    }
+}
+
+/**
+ * Check if a pool is done: the pool is stopping and no task is left
+ * to run or steal, except those already running.
+ * @param pool the pool
+ * @return if the pool is done
+ */
+bool processor_pool_done(processor_pool *pool) {
+
+    if (!atomic_load(&pool->stopping)) return false;
+
+    for (int i = 0; i < pool->max; ++i) {
+        processor *p = pool->processors + i;
+
+        if (0 != blocking_q_size(p->tasks) || 0 != ws_deque_size(&p->deque))
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * Run a task on a processor and release it. The task records when it
+ * ran, the time adds up in the work time of the processor and its
+ * latencies go to the histograms of the processor and its service
+ * time to the cost model of the pool. A task ending after its deadline
+ * counts as a miss. The processor it was handed to no longer counts it
+ * as outstanding.
+ * @param self the processor
+ * @param t the task
+ */
+void processor_execute(processor *self, task_ptr t) {
+    t->start = monotonic_now();
+
+    switch (t->type) {
+        case 'A':
+            task_a();
+            break;
+        case 'B':
+            task_b();
+            break;
+        case 'C':
+            task_c();
+            break;
+        case 'D':
+            task_d();
+            break;
+        default:
+            break;
+    }
+
+    t->end = monotonic_now();
+    self->work_t += t->end - t->start;
+
+    if (t->type >= 'A' && t->type < 'A' + TASK_TYPES) {
+        histogram *latency = self->latency[t->type - 'A'];
+
+        histogram_record(&latency[TASK_QUEUE_WAIT], t->dispatched - t->enqueued);
+        histogram_record(&latency[TASK_SERVICE], t->end - t->start);
+        histogram_record(&latency[TASK_END_TO_END], t->end - t->enqueued);
+    }
+
+    processor_pool *pool = self->pool;
+
+    if (t->type >= 'A' && t->type < 'A' + TASK_TYPES) {
+        int type = t->type - 'A';
+
+        cost_model_record(&pool->costs[type], t->end - t->start);
+
+        if (0 != t->deadline && t->end > t->deadline) ++self->deadline_missed[type];
+        else if (0 != t->deadline) ++self->deadline_met[type];
+    }
+
+    if (t->processor >= 0) {
+        processor *owner = pool->processors + t->processor;
+        atomic_fetch_sub(&owner->outstanding, 1);
+        atomic_fetch_sub(&owner->outstanding_cost, t->cost);
+    }
+
+    if (NULL != pool->policy) sched_policy_task_complete(pool->policy, self, t);
+
+    free(t);
+}
+
+/**
+ * Expected cost of a task, learned from the tasks of the same type
+ * that completed.
+ * @param pool the pool
+ * @param t the task
+ * @return the cost in nanoseconds
+ */
+long processor_pool_expected_cost(processor_pool *pool, task_ptr t) {
+
+    if (t->type >= 'A' && t->type < 'A' + TASK_TYPES)
+        return cost_model_mean(&pool->costs[t->type - 'A']);
+
+    return task_cost(t) * TASK_T_NS;
+}
+
+/**
+ * Store the learned cost of a task in it as it is released to the
+ * scheduler, the scheduler queue orders the tasks by it. Called by
+ * the thread running the delay queue.
+ * @param t the task
+ * @param v_pool the pool
+ */
+void processor_pool_estimate(task_ptr t, void *v_pool) {
+    t->cost = processor_pool_expected_cost((processor_pool *) v_pool, t);
+}
+
+/**
+ * Print the latency percentiles, the deadline misses and the learned
+ * cost of every task type, over all the processors of a stopped pool.
+ * Times are in nanoseconds.
+ * @param pool the pool
+ */
+void processor_pool_print_latencies(processor_pool *pool) {
+    static const char *names[TASK_LATENCIES] = {"Queue wait", "Service", "End to end"};
+
+    for (int type = 0; type < TASK_TYPES; ++type) {
+        cost_model *cost = &pool->costs[type];
+
+        if (0 != atomic_load(&cost->samples))
+            printf("Task %c %-10s: mean: %ld stddev: %ld\n",
+                   'A' + type,
+                   "Cost",
+                   cost_model_mean(cost),
+                   cost_model_stddev(cost));
+
+        long met = 0;
+        long missed = 0;
+
+        for (int i = 0; i < pool->max; ++i) {
+            met += pool->processors[i].deadline_met[type];
+            missed += pool->processors[i].deadline_missed[type];
+        }
+
+        if (0 != met + missed)
+            printf("Task %c %-10s: missed: %ld of %ld\n", 'A' + type, "Deadline", missed, met + missed);
+
+        for (int l = 0; l < TASK_LATENCIES; ++l) {
+            histogram merged;
+            histogram_init(&merged);
+
+            for (int i = 0; i < pool->max; ++i)
+                histogram_merge(&merged, &pool->processors[i].latency[type][l]);
+
+            if (0 == merged.count) continue;
+
+            printf("Task %c %-10s: n: %lu p50: %ld p90: %ld p99: %ld p99.9: %ld max: %ld\n",
+                   'A' + type,
+                   names[l],
+                   (unsigned long) merged.count,
+                   histogram_percentile(&merged, 50),
+                   histogram_percentile(&merged, 90),
+                   histogram_percentile(&merged, 99),
+                   histogram_percentile(&merged, 99.9),
+                   merged.max);
+        }
+    }
+}
+
+/**
+ * Code executed by a processor thread. Moves the tasks of its queue
+ * to its deque and runs them, newest first. Once it has nothing left,
+ * it steals the oldest tasks of the other processors. Retires after
+ * it found nothing to do for a while, or stops when the pool is
+ * stopping and there is nothing left to run or steal.
+ * The time the thread ran adds up in the real time of the processor,
+ * the time it waited for the scheduler in its wait time.
+ * @param v_self the processor
+ * @return NULL
+ */
+void *processor_run(void *v_self) {
+    processor *self = (processor *) v_self;
+
+    task_ptr batch[PROCESSOR_DEQUE_CAPACITY];
+    unsigned int seed = (unsigned int) self->id + 1;
+    long idle_since = 0;
+    long begin = monotonic_now();
+
+    for (;;) {
+        task_ptr t;
+
+        if (self->pool->edf) {
+            // the queue orders the tasks, thieves take from it directly
+            t = blocking_q_try_get(self->tasks);
+        } else {
+            // make the dispatched tasks visible to thieves
+            size_t room = PROCESSOR_DEQUE_CAPACITY - ws_deque_size(&self->deque);
+            size_t batch_sz = blocking_q_drain(self->tasks, batch, room);
+
+            for (size_t i = 0; i < batch_sz; ++i)
+                ws_deque_push(&self->deque, batch[i]);
+
+            t = ws_deque_take(&self->deque);
+        }
+
+        if (NULL == t) t = processor_steal(self, &seed);
+
+        if (NULL != t) {
+            processor_execute(self, t);
+            idle_since = 0;
+            continue;
+        }
+
+        // nothing anywhere, wait for the scheduler for a while
+        if (NULL != self->pool->policy) sched_policy_idle(self->pool->policy, self);
+
+        long wait_start = monotonic_now();
+        t = blocking_q_get_timeout(self->tasks, STEAL_INTERVAL);
+
+        if (NULL != t) {
+            self->wait_t += monotonic_now() - wait_start;
+            processor_execute(self, t);
+            idle_since = 0;
+            continue;
+        }
+
+        if (processor_pool_done(self->pool)) {
+            self->wait_t += monotonic_now() - wait_start;
+            break;
+        }
+
+        // a closed queue returns at once and nothing is dispatched
+        // anymore, the last tasks are elsewhere: poll them less often
+        if (blocking_q_is_closed(self->tasks)) {
+            struct timespec backoff = {0, STEAL_INTERVAL};
+            clock_nanosleep(CLOCK_MONOTONIC, 0, &backoff, NULL);
+        }
+
+        long now = monotonic_now();
+        self->wait_t += now - wait_start;
+
+        if (0 == idle_since) idle_since = now;
+        else if (now - idle_since >= POOL_COOLDOWN && processor_retire(self)) break;
+    }
+
+    self->real_t += monotonic_now() - begin;
+
+    return NULL;
+}
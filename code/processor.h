@@ -0,0 +1,144 @@
+#ifndef PROCESSOR_H
+#define PROCESSOR_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "blocking_q.h"
+#include "ws_deque.h"
+#include "histogram.h"
+#include "cost_model.h"
+#include "task.h"
+
+// The scheduler is the only producer of a processor queue. Idle
+// processors take from the queue of a busy one, so it has several
+// consumers: the queues used to be BLOCKING_Q_SPSC, which only the
+// owner may take from, and tasks handed to a processor busy with a
+// long task waited for it while its siblings idled. A handoff through
+// BLOCKING_Q_MPMC costs some 10 to 20 ns more, against tasks of seconds.
+// Consumers spin up to PROCESSOR_Q_SPIN times before parking.
+#define PROCESSOR_Q_KIND BLOCKING_Q_MPMC
+#define PROCESSOR_Q_CAPACITY 64
+#define PROCESSOR_Q_SPIN 4096
+
+// Tasks a processor may hold in its work-stealing deque, and how long
+// an idle processor waits for the scheduler before trying to steal again
+#define PROCESSOR_DEQUE_CAPACITY 256
+#define STEAL_INTERVAL (10 * 1000 * 1000)
+
+// The pool grows by as many processors as it takes to get back under
+// POOL_HIGH_WATER outstanding tasks per running processor, the running
+// tasks included.
+// Two is one task running and the next one queued behind it, ready as
+// soon as the first ends: a task waits behind one other at most before
+// another processor starts, and a burst of tasks no longer starts a
+// thread for each of them.
+// A processor retires once it found nothing to run for POOL_COOLDOWN, 1 s.
+#define POOL_HIGH_WATER 2
+#define POOL_COOLDOWN (1000 * 1000 * 1000L)
+
+/**
+ * Life cycle of a processor thread. A processor is only handed tasks
+ * while it is running. A retiring one runs what it was already handed,
+ * then stops and may be started again later.
+ */
+typedef enum processor_state {
+    PROCESSOR_STOPPED,
+    PROCESSOR_RUNNING,
+    PROCESSOR_RETIRING
+} processor_state;
+
+/**
+ * A processor owns a queue of tasks fed by the scheduler and
+ * keeps its own time accounting. It moves its tasks to a deque
+ * where idle processors of the same pool can steal them, they take
+ * from the queue itself while the processor is busy.
+ * The structure outlives the threads running it, so that the
+ * accounting covers every one of them. It spans whole cache lines,
+ * neighbours in the pool array never share one.
+ */
+typedef struct processor {
+    int id;
+    int cpu;
+    bool started;
+    pthread_t thread;
+    blocking_q *tasks;
+    struct processor_pool *pool;
+
+    // written by the scheduler on every dispatch, the outstanding tasks
+    // and their expected cost also on completion: tasks handed to the
+    // processor and not completed yet
+    _Alignas(BLOCKING_Q_CACHE_LINE) _Atomic int state;
+    _Atomic bool dispatching;
+    _Atomic long outstanding;
+    _Atomic long outstanding_cost;
+
+    ws_deque deque;
+
+    // written by the processor thread only, on lines of their own
+    _Alignas(BLOCKING_Q_CACHE_LINE) pthread_mutex_t lock;
+    long real_t;
+    long work_t;
+    long wait_t;
+    histogram (*latency)[TASK_LATENCIES];
+    long deadline_met[TASK_TYPES];
+    long deadline_missed[TASK_TYPES];
+} processor;
+
+/**
+ * Processors able to run tasks. Between min and max of them are
+ * running, more are started when the tasks pile up and idle ones
+ * retire on their own. The policy of the scheduler hears about the
+ * tasks they complete and when they are idle. The cost of each task
+ * type is learned from the service times they measure.
+ * With `edf`, each processor runs the earliest deadline of its queue
+ * first, an idle processor takes the earliest one of another queue.
+ */
+typedef struct processor_pool {
+    processor *processors;
+    int min;
+    int max;
+    bool edf;
+    _Atomic int active;
+    _Atomic bool stopping;
+    struct sched_policy *policy;
+    cost_model costs[TASK_TYPES];
+} processor_pool;
+
+bool thread_attr_init(pthread_attr_t *attr, const int *cpus, int cpu_c);
+
+bool processor_init(int id, processor *p, bool edf);
+
+void processor_destroy(processor *p);
+
+bool processor_start(processor *p);
+
+bool processor_dispatch(processor *p, task_ptr t);
+
+bool processor_retire(processor *self);
+
+task_ptr processor_steal(processor *self, unsigned int *seed);
+
+bool processor_pool_init(processor_pool *pool, int min, int max, bool edf);
+
+void processor_pool_destroy(processor_pool *pool);
+
+int processor_pool_grow(processor_pool *pool, blocking_q *sched_q, size_t arriving);
+
+void processor_pool_stop(processor_pool *pool);
+
+void processor_pool_join(processor_pool *pool);
+
+bool processor_pool_done(processor_pool *pool);
+
+long processor_pool_expected_cost(processor_pool *pool, task_ptr t);
+
+void processor_pool_estimate(task_ptr t, void *v_pool);
+
+void processor_pool_print_latencies(processor_pool *pool);
+
+void processor_execute(processor *self, task_ptr t);
+
+void *processor_run(void *v_self);
+
+#endif //PROCESSOR_H
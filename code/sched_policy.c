@@ -0,0 +1,449 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "sched_policy.h"
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
+
+/**
+ * Internal function to sched_policy. Check if the scheduler may hand
+ * tasks to a processor.
+ * @param p the processor
+ * @return if the processor is running
+ */
+bool __sched_policy_running(processor *p) { // NOLINT(bugprone-reserved-identifier)
+    return PROCESSOR_RUNNING == atomic_load(&p->state);
+}
+
+/**
+ * State of the round-robin and random policies, owned by the
+ * scheduler thread. `next` is also where the other policies start
+ * their scan, so that ties go round.
+ */
+typedef struct sched_policy_cursor {
+    int next;
+    unsigned int seed;
+} sched_policy_cursor;
+
+/**
+ * Internal function to sched_policy. Creates the cursor of a policy.
+ * @param policy the policy
+ * @return if init was successful.
+ */
+bool __sched_policy_cursor_init(sched_policy *policy) { // NOLINT(bugprone-reserved-identifier)
+    sched_policy_cursor *cursor = malloc(sizeof(sched_policy_cursor));
+    if (NULL == cursor) return false;
+
+    cursor->next = 0;
+    cursor->seed = 1;
+    policy->state = cursor;
+    return true;
+}
+
+/**
+ * Internal function to sched_policy. Releases a state allocated by
+ * the policy.
+ * @param policy the policy
+ */
+void __sched_policy_state_destroy(sched_policy *policy) { // NOLINT(bugprone-reserved-identifier)
+    free(policy->state);
+}
+
+/**
+ * Internal function to sched_policy. Running processor with the lowest
+ * load, scanning from `start`. The first one wins a tie.
+ * @param policy the policy
+ * @param start the first processor scanned
+ * @param load the load of a processor
+ * @return the processor, NULL if none is running
+ */
+processor *__sched_policy_least(sched_policy *policy, int start, long (*load)(sched_policy *, processor *)) { // NOLINT(bugprone-reserved-identifier)
+    processor_pool *pool = policy->pool;
+    processor *best = NULL;
+    long best_load = 0;
+
+    for (int i = 0; i < pool->max; ++i) {
+        processor *p = pool->processors + (start + i) % pool->max;
+        if (!__sched_policy_running(p)) continue;
+
+        long p_load = load(policy, p);
+
+        if (NULL == best || p_load < best_load) {
+            best = p;
+            best_load = p_load;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * Round-robin: the next running processor after the last one picked.
+ * @param policy the policy
+ * @param t the task
+ * @return the processor, NULL if none is running
+ */
+processor *__sched_policy_round_robin_pick(sched_policy *policy, task_ptr t) { // NOLINT(bugprone-reserved-identifier)
+    (void) t;
+    sched_policy_cursor *cursor = policy->state;
+    processor_pool *pool = policy->pool;
+
+    for (int i = 0; i < pool->max; ++i) {
+        processor *p = pool->processors + cursor->next;
+        cursor->next = (cursor->next + 1) % pool->max;
+
+        if (__sched_policy_running(p)) return p;
+    }
+
+    return NULL;
+}
+
+const sched_policy_ops sched_policy_round_robin = {
+        "round-robin",
+        __sched_policy_cursor_init,
+        __sched_policy_state_destroy,
+        NULL,
+        __sched_policy_round_robin_pick,
+        NULL,
+        NULL
+};
+
+/**
+ * Random: any running processor, uniformly.
+ * @param policy the policy
+ * @param t the task
+ * @return the processor, NULL if none is running
+ */
+processor *__sched_policy_random_pick(sched_policy *policy, task_ptr t) { // NOLINT(bugprone-reserved-identifier)
+    (void) t;
+    sched_policy_cursor *cursor = policy->state;
+    processor_pool *pool = policy->pool;
+
+    int start = rand_r(&cursor->seed) % pool->max;
+
+    for (int i = 0; i < pool->max; ++i) {
+        processor *p = pool->processors + (start + i) % pool->max;
+        if (__sched_policy_running(p)) return p;
+    }
+
+    return NULL;
+}
+
+const sched_policy_ops sched_policy_random = {
+        "random",
+        __sched_policy_cursor_init,
+        __sched_policy_state_destroy,
+        NULL,
+        __sched_policy_random_pick,
+        NULL,
+        NULL
+};
+
+/**
+ * Internal function to sched_policy. Tasks waiting in the queue and
+ * in the deque of a processor, a snapshot.
+ * @param policy the policy
+ * @param p the processor
+ * @return the amount of tasks
+ */
+long __sched_policy_queued(sched_policy *policy, processor *p) { // NOLINT(bugprone-reserved-identifier)
+    (void) policy;
+    return (long) (blocking_q_size(p->tasks) + ws_deque_size(&p->deque));
+}
+
+/**
+ * Least-queued: the running processor with the fewest tasks waiting.
+ * The task it runs does not count.
+ * @param policy the policy
+ * @param t the task
+ * @return the processor, NULL if none is running
+ */
+processor *__sched_policy_least_queued_pick(sched_policy *policy, task_ptr t) { // NOLINT(bugprone-reserved-identifier)
+    (void) t;
+    sched_policy_cursor *cursor = policy->state;
+
+    processor *p = __sched_policy_least(policy, cursor->next, __sched_policy_queued);
+    cursor->next = (cursor->next + 1) % policy->pool->max;
+
+    return p;
+}
+
+const sched_policy_ops sched_policy_least_queued = {
+        "least-queued",
+        __sched_policy_cursor_init,
+        __sched_policy_state_destroy,
+        NULL,
+        __sched_policy_least_queued_pick,
+        NULL,
+        NULL
+};
+
+/**
+ * Internal function to sched_policy. Tasks a processor was handed and
+ * did not complete yet, the running one included.
+ * @param policy the policy
+ * @param p the processor
+ * @return the amount of tasks
+ */
+long __sched_policy_outstanding(sched_policy *policy, processor *p) { // NOLINT(bugprone-reserved-identifier)
+    (void) policy;
+    return atomic_load_explicit(&p->outstanding, memory_order_relaxed);
+}
+
+/**
+ * Least-outstanding-work: the running processor with the fewest tasks
+ * handed to it and not completed, wherever they run.
+ * @param policy the policy
+ * @param t the task
+ * @return the processor, NULL if none is running
+ */
+processor *__sched_policy_least_outstanding_pick(sched_policy *policy, task_ptr t) { // NOLINT(bugprone-reserved-identifier)
+    (void) t;
+    sched_policy_cursor *cursor = policy->state;
+
+    processor *p = __sched_policy_least(policy, cursor->next, __sched_policy_outstanding);
+    cursor->next = (cursor->next + 1) % policy->pool->max;
+
+    return p;
+}
+
+const sched_policy_ops sched_policy_least_outstanding = {
+        "least-outstanding",
+        __sched_policy_cursor_init,
+        __sched_policy_state_destroy,
+        NULL,
+        __sched_policy_least_outstanding_pick,
+        NULL,
+        NULL
+};
+
+/**
+ * Internal function to sched_policy. Expected cost of the tasks a
+ * processor was handed and did not complete yet, the running one
+ * included.
+ * @param policy the policy
+ * @param p the processor
+ * @return the cost
+ */
+long __sched_policy_outstanding_cost(sched_policy *policy, processor *p) { // NOLINT(bugprone-reserved-identifier)
+    (void) policy;
+    return atomic_load_explicit(&p->outstanding_cost, memory_order_relaxed);
+}
+
+/**
+ * Least-expected-work: the running processor that is expected to
+ * finish the task first, the one with the least outstanding cost.
+ * @param policy the policy
+ * @param t the task
+ * @return the processor, NULL if none is running
+ */
+processor *__sched_policy_least_expected_work_pick(sched_policy *policy, task_ptr t) { // NOLINT(bugprone-reserved-identifier)
+    (void) t;
+    sched_policy_cursor *cursor = policy->state;
+
+    processor *p = __sched_policy_least(policy, cursor->next, __sched_policy_outstanding_cost);
+    cursor->next = (cursor->next + 1) % policy->pool->max;
+
+    return p;
+}
+
+const sched_policy_ops sched_policy_least_expected_work = {
+        "least-expected-work",
+        __sched_policy_cursor_init,
+        __sched_policy_state_destroy,
+        NULL,
+        __sched_policy_least_expected_work_pick,
+        NULL,
+        NULL
+};
+
+/**
+ * State of the xorshift64* generator of the calling thread, seeded
+ * from its address on first use so that threads differ.
+ */
+_Thread_local uint64_t sched_policy_rng = 0;
+
+/**
+ * Fast random number of the calling thread, without any lock.
+ * @param bound the upper bound, not 0
+ * @return a random number below the bound
+ */
+uint32_t sched_policy_random_below(uint32_t bound) {
+    uint64_t x = sched_policy_rng;
+
+    if (0 == x) x = (uint64_t) (uintptr_t) &sched_policy_rng | 1;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    sched_policy_rng = x;
+
+    // the high bits are the best ones, scaled without a division
+    return (uint32_t) (((x * 0x2545F4914F6CDD1DULL) >> 32) * bound >> 32);
+}
+
+/**
+ * Internal function to sched_policy. Power of d choices: the least
+ * loaded of SCHED_POLICY_CHOICES running processors drawn at random.
+ * Falls back to a scan of the pool when the samples hit too few
+ * running processors, as when the pool shrank.
+ * @param policy the policy
+ * @param load the load of a processor
+ * @return the processor, NULL if none is running
+ */
+processor *__sched_policy_power_of_d(sched_policy *policy, long (*load)(sched_policy *, processor *)) { // NOLINT(bugprone-reserved-identifier)
+    processor_pool *pool = policy->pool;
+    processor *best = NULL;
+    long best_load = 0;
+    int chosen = 0;
+
+    for (int i = 0; i < SCHED_POLICY_SAMPLES && chosen < SCHED_POLICY_CHOICES; ++i) {
+        processor *p = pool->processors + sched_policy_random_below((uint32_t) pool->max);
+        if (!__sched_policy_running(p)) continue;
+
+        ++chosen;
+        long p_load = load(policy, p);
+
+        if (NULL == best || p_load < best_load) {
+            best = p;
+            best_load = p_load;
+        }
+    }
+
+    if (chosen < SCHED_POLICY_CHOICES)
+        return __sched_policy_least(policy, (int) sched_policy_random_below((uint32_t) pool->max), load);
+
+    return best;
+}
+
+/**
+ * Power of d choices, by the tasks waiting in the sampled processors.
+ * @param policy the policy
+ * @param t the task
+ * @return the processor, NULL if none is running
+ */
+processor *__sched_policy_power_of_d_queued_pick(sched_policy *policy, task_ptr t) { // NOLINT(bugprone-reserved-identifier)
+    (void) t;
+    return __sched_policy_power_of_d(policy, __sched_policy_queued);
+}
+
+const sched_policy_ops sched_policy_power_of_d_queued = {
+        "power-of-d-queued",
+        NULL,
+        NULL,
+        NULL,
+        __sched_policy_power_of_d_queued_pick,
+        NULL,
+        NULL
+};
+
+/**
+ * Power of d choices, by the outstanding cost of the sampled
+ * processors.
+ * @param policy the policy
+ * @param t the task
+ * @return the processor, NULL if none is running
+ */
+processor *__sched_policy_power_of_d_work_pick(sched_policy *policy, task_ptr t) { // NOLINT(bugprone-reserved-identifier)
+    (void) t;
+    return __sched_policy_power_of_d(policy, __sched_policy_outstanding_cost);
+}
+
+const sched_policy_ops sched_policy_power_of_d_work = {
+        "power-of-d-work",
+        NULL,
+        NULL,
+        NULL,
+        __sched_policy_power_of_d_work_pick,
+        NULL,
+        NULL
+};
+
+/**
+ * Built-in policy with a name.
+ * @param name the name of the policy
+ * @return the policy, NULL if there is none with this name
+ */
+const sched_policy_ops *sched_policy_find(const char *name) {
+    static const sched_policy_ops *builtins[] = {
+            &sched_policy_round_robin,
+            &sched_policy_random,
+            &sched_policy_least_queued,
+            &sched_policy_least_outstanding,
+            &sched_policy_least_expected_work,
+            &sched_policy_power_of_d_queued,
+            &sched_policy_power_of_d_work
+    };
+
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); ++i)
+        if (0 == strcmp(builtins[i]->name, name)) return builtins[i];
+
+    return NULL;
+}
+
+/**
+ * Initialises a policy for a pool. This can fail if the policy cannot
+ * create its state.
+ * @param policy the policy
+ * @param ops the operations of the policy
+ * @param pool the pool
+ * @return if init was successful.
+ */
+bool sched_policy_init(sched_policy *policy, const sched_policy_ops *ops, processor_pool *pool) {
+    policy->ops = ops;
+    policy->pool = pool;
+    policy->state = NULL;
+
+    return NULL == ops->init || ops->init(policy);
+}
+
+/**
+ * Destroy a policy. No thread may use it anymore.
+ * @param policy the policy
+ */
+void sched_policy_destroy(sched_policy *policy) {
+    if (NULL != policy->ops->destroy) policy->ops->destroy(policy);
+}
+
+/**
+ * A task arrived to the scheduler. Only the scheduler may call it.
+ * @param policy the policy
+ * @param t the task
+ */
+void sched_policy_task_arrival(sched_policy *policy, task_ptr t) {
+    if (NULL != policy->ops->on_task_arrival) policy->ops->on_task_arrival(policy, t);
+}
+
+/**
+ * Pick the processor a task goes to. Only the scheduler may call it.
+ * A retiring processor may still refuse the task, pick again then.
+ * @param policy the policy
+ * @param t the task
+ * @return the processor, NULL if none is running
+ */
+processor *sched_policy_pick_processor(sched_policy *policy, task_ptr t) {
+    return policy->ops->pick_processor(policy, t);
+}
+
+/**
+ * A processor ran a task, it is still valid. Any processor may call it.
+ * @param policy the policy
+ * @param p the processor that ran the task
+ * @param t the task
+ */
+void sched_policy_task_complete(sched_policy *policy, processor *p, task_ptr t) {
+    if (NULL != policy->ops->on_task_complete) policy->ops->on_task_complete(policy, p, t);
+}
+
+/**
+ * A processor found nothing to run and is about to wait for the
+ * scheduler. Any processor may call it.
+ * @param policy the policy
+ * @param p the processor
+ */
+void sched_policy_idle(sched_policy *policy, processor *p) {
+    if (NULL != policy->ops->on_idle) policy->ops->on_idle(policy, p);
+}
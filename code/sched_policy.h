@@ -0,0 +1,67 @@
+#ifndef SCHED_POLICY_H
+#define SCHED_POLICY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "blocking_q.h"
+#include "processor.h"
+
+// Processors sampled by the power-of-d-choices policies, and how many
+// samples they draw at most to find that many running processors
+#define SCHED_POLICY_CHOICES 2
+#define SCHED_POLICY_SAMPLES (4 * SCHED_POLICY_CHOICES)
+
+typedef struct sched_policy sched_policy;
+
+/**
+ * Operations of a scheduling policy. The scheduler thread calls
+ * on_task_arrival for every task it takes from its queue, then
+ * pick_processor until the processor it returns accepts the task.
+ * Processor threads call on_task_complete once they ran a task and
+ * on_idle before they wait for the scheduler, concurrently.
+ * Every operation but pick_processor may be NULL.
+ */
+typedef struct sched_policy_ops {
+    const char *name;
+    bool (*init)(sched_policy *policy);
+    void (*destroy)(sched_policy *policy);
+    void (*on_task_arrival)(sched_policy *policy, task_ptr t);
+    processor *(*pick_processor)(sched_policy *policy, task_ptr t);
+    void (*on_task_complete)(sched_policy *policy, processor *p, task_ptr t);
+    void (*on_idle)(sched_policy *policy, processor *p);
+} sched_policy_ops;
+
+/**
+ * A scheduling policy of a pool and its state.
+ */
+struct sched_policy {
+    const sched_policy_ops *ops;
+    processor_pool *pool;
+    void *state;
+};
+
+extern const sched_policy_ops sched_policy_round_robin;
+extern const sched_policy_ops sched_policy_random;
+extern const sched_policy_ops sched_policy_least_queued;
+extern const sched_policy_ops sched_policy_least_outstanding;
+extern const sched_policy_ops sched_policy_least_expected_work;
+extern const sched_policy_ops sched_policy_power_of_d_queued;
+extern const sched_policy_ops sched_policy_power_of_d_work;
+
+uint32_t sched_policy_random_below(uint32_t bound);
+
+const sched_policy_ops *sched_policy_find(const char *name);
+
+bool sched_policy_init(sched_policy *policy, const sched_policy_ops *ops, processor_pool *pool);
+
+void sched_policy_destroy(sched_policy *policy);
+
+void sched_policy_task_arrival(sched_policy *policy, task_ptr t);
+
+processor *sched_policy_pick_processor(sched_policy *policy, task_ptr t);
+
+void sched_policy_task_complete(sched_policy *policy, processor *p, task_ptr t);
+
+void sched_policy_idle(sched_policy *policy, processor *p);
+
+#endif //SCHED_POLICY_H
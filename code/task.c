@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <unistd.h>
+#include "task.h"
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
+
+/**
+ * Code executed by task A
+ */
+long task_a() {
+    printf("Task A starting...\n");
+    sleep(5);
+    printf("Task A ending...\n");
+    return TASK_A_T;
+}
+
+/**
+ * Code executed by task B
+ */
+long task_b() {
+    printf("Task B starting...\n");
+    sleep(10);
+    printf("Task B ending...\n");
+    return TASK_B_T;
+}
+
+/**
+ * Code executed by task C
+ */
+long task_c() {
+    printf("Task C starting...\n");
+    sleep(15);
+    printf("Task C starting...\n");
+    return TASK_C_T;
+}
+
+/**
+ * Code executed by task D
+ */
+long task_d() {
+    printf("Task D starting...\n");
+    sleep(20);
+    printf("Task D starting...\n");
+    return TASK_D_T;
+}
+
+/**
+ * Nominal cost of a task, the cost models start from it.
+ * @param t the task
+ * @return the time the task takes in milliseconds
+ */
+long task_cost(task_ptr t) {
+    switch (t->type) {
+        case 'A':
+            return TASK_A_T;
+        case 'B':
+            return TASK_B_T;
+        case 'C':
+            return TASK_C_T;
+        case 'D':
+            return TASK_D_T;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Key of a task in a shortest job first queue: the cost expected when
+ * it was released, see processor_pool_estimate.
+ * @param t the task
+ * @return the expected cost in nanoseconds
+ */
+long task_expected_cost(task_ptr t) {
+    return t->cost;
+}
+
+/**
+ * Key of a task in an earliest deadline first queue. Tasks without a
+ * deadline come last.
+ * @param t the task
+ * @return the deadline of the task
+ */
+long task_deadline(task_ptr t) {
+    return 0 != t->deadline ? t->deadline : LONG_MAX;
+}
+
+/**
+ * Parse the deadlines of the task types, see TASK_DEADLINES_ENV in main.c.
+ * @param arg the deadlines in milliseconds, NULL if none
+ * @param deadlines the deadline of each type in nanoseconds, 0 for none
+ * @return if any type has a deadline
+ */
+bool task_deadlines(const char *arg, long *deadlines) {
+    bool any = false;
+
+    for (int type = 0; type < TASK_TYPES; ++type) {
+        deadlines[type] = 0;
+
+        if (NULL == arg || '\0' == *arg) continue;
+
+        char *end;
+        long ms = strtol(arg, &end, 10);
+
+        if (ms > 0) {
+            deadlines[type] = ms * TASK_T_NS;
+            any = true;
+        }
+
+        arg = ',' == *end ? end + 1 : end;
+    }
+
+    return any;
+}
+
+/**
+ * Free a task the scheduler queue refused, it will not run.
+ * @param t the task
+ * @param arg unused
+ */
+void task_drop(task_ptr t, void *arg) {
+    (void) arg;
+    free(t);
+}
@@ -0,0 +1,47 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include <stdbool.h>
+#include "blocking_q.h"
+
+// Task types are the letters 'A' to 'A' + TASK_TYPES - 1
+#define TASK_TYPES 4
+
+#define TASK_A_T (5 * 1000)
+#define TASK_B_T (10 * 1000)
+#define TASK_C_T (15 * 1000)
+#define TASK_D_T (20 * 1000)
+
+// TASK_*_T are in milliseconds, costs are learned in nanoseconds
+#define TASK_T_NS (1000 * 1000L)
+
+/**
+ * Latencies recorded for every task: from the scheduler queue to a
+ * processor, the run itself, and from the scheduler queue to the end.
+ */
+typedef enum task_latency {
+    TASK_QUEUE_WAIT,
+    TASK_SERVICE,
+    TASK_END_TO_END,
+    TASK_LATENCIES
+} task_latency;
+
+long task_a();
+
+long task_b();
+
+long task_c();
+
+long task_d();
+
+long task_cost(task_ptr t);
+
+long task_expected_cost(task_ptr t);
+
+long task_deadline(task_ptr t);
+
+bool task_deadlines(const char *arg, long *deadlines);
+
+void task_drop(task_ptr t, void *arg);
+
+#endif //TASK_H
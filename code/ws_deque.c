@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "ws_deque.h"
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
+
+/**
+ * Create an empty deque.
+ * @param d the deque
+ * @param capacity the maximum amount of elements, rounded up to a
+ * power of two
+ * @return if init was successful.
+ */
+bool ws_deque_init(ws_deque *d, size_t capacity) {
+
+    if (capacity == 0) return false;
+
+    d->capacity = 1;
+    while (d->capacity < capacity) d->capacity <<= 1;
+
+    d->buffer = malloc(sizeof(_Atomic(task_ptr)) * d->capacity);
+    if (d->buffer == NULL) return false;
+
+    for (size_t i = 0; i < d->capacity; ++i)
+        atomic_init(d->buffer + i, NULL);
+
+    atomic_init(&d->top, 0);
+    atomic_init(&d->bottom, 0);
+
+    return true;
+}
+
+/**
+ * Destroy a deque. No thread may use it anymore.
+ * @param d the deque
+ */
+void ws_deque_destroy(ws_deque *d) {
+    free(d->buffer);
+}
+
+/**
+ * Amount of elements in the deque. This is only a snapshot when
+ * other threads use the deque.
+ * @param d the deque
+ * @return the amount of elements
+ */
+size_t ws_deque_size(ws_deque *d) {
+    long top = atomic_load(&d->top);
+    long bottom = atomic_load(&d->bottom);
+    return bottom > top ? (size_t) (bottom - top) : 0;
+}
+
+/**
+ * Push an element at the owner's end. Only the owner may call this.
+ * @param d the deque
+ * @param data the element
+ * @return if the element was pushed, false if the deque was full
+ */
+bool ws_deque_push(ws_deque *d, task_ptr data) {
+
+    long bottom = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    long top = atomic_load_explicit(&d->top, memory_order_acquire);
+
+    if ((size_t) (bottom - top) >= d->capacity) return false;
+
+    atomic_store_explicit(d->buffer + (bottom & (d->capacity - 1)), data, memory_order_relaxed);
+
+    // the element must be visible before thieves can reach it
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, bottom + 1, memory_order_relaxed);
+
+    return true;
+}
+
+/**
+ * Take the element pushed last. Only the owner may call this.
+ * @param d the deque
+ * @return the element, NULL if the deque was empty or a thief took
+ * the last element
+ */
+task_ptr ws_deque_take(ws_deque *d) {
+
+    long bottom = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+
+    // reserve the bottom element before looking at the thieves' end
+    atomic_store_explicit(&d->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long top = atomic_load_explicit(&d->top, memory_order_relaxed);
+
+    if (top > bottom) {
+        // empty, undo the reservation
+        atomic_store_explicit(&d->bottom, bottom + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    task_ptr data = atomic_load_explicit(d->buffer + (bottom & (d->capacity - 1)), memory_order_relaxed);
+
+    if (top == bottom) {
+        // last element, race the thieves for it
+        if (!atomic_compare_exchange_strong_explicit(&d->top, &top, top + 1,
+                                                     memory_order_seq_cst, memory_order_relaxed))
+            data = NULL;
+
+        atomic_store_explicit(&d->bottom, bottom + 1, memory_order_relaxed);
+    }
+
+    return data;
+}
+
+/**
+ * Steal the oldest element. Any thread may call this.
+ * @param d the deque
+ * @return the element, NULL if the deque was empty or another thread
+ * took the element first
+ */
+task_ptr ws_deque_steal(ws_deque *d) {
+
+    long top = atomic_load_explicit(&d->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long bottom = atomic_load_explicit(&d->bottom, memory_order_acquire);
+
+    if (top >= bottom) return NULL;
+
+    task_ptr data = atomic_load_explicit(d->buffer + (top & (d->capacity - 1)), memory_order_relaxed);
+
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &top, top + 1,
+                                                 memory_order_seq_cst, memory_order_relaxed))
+        return NULL;
+
+    return data;
+}
@@ -0,0 +1,36 @@
+#ifndef WS_DEQUE_H
+#define WS_DEQUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include "blocking_q.h"
+
+/**
+ * Chase-Lev work-stealing deque of a processor.
+ *
+ * The owner thread pushes and takes at the `bottom` end, LIFO, other
+ * threads steal at the `top` end, FIFO, with a CAS on `top`. Only the
+ * last element is contended between the owner and thieves. Bounded
+ * to a power of two `capacity`, a push on a full deque fails.
+ */
+typedef struct ws_deque {
+    _Alignas(BLOCKING_Q_CACHE_LINE) _Atomic long top;
+    _Alignas(BLOCKING_Q_CACHE_LINE) _Atomic long bottom;
+    size_t capacity;
+    _Atomic(task_ptr) *buffer;
+} ws_deque;
+
+bool ws_deque_init(ws_deque *d, size_t capacity);
+
+void ws_deque_destroy(ws_deque *d);
+
+size_t ws_deque_size(ws_deque *d);
+
+bool ws_deque_push(ws_deque *d, task_ptr data);
+
+task_ptr ws_deque_take(ws_deque *d);
+
+task_ptr ws_deque_steal(ws_deque *d);
+
+#endif //WS_DEQUE_H